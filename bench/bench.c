@@ -0,0 +1,488 @@
+/**
+ ******************************************************************************
+ ***                                                                        ***
+ *             VKE   -   End to end throughput benchmark driver               *
+ ***                                                                        ***
+ ******************************************************************************
+ */
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>        // printf, fprintf, snprintf, stderr
+#include <stdlib.h>       // malloc, free, atoi
+#include <string.h>       // strcmp, strchr, strlen, strncpy
+#include <time.h>         // clock_gettime, CLOCK_MONOTONIC
+#include <unistd.h>       // fork, execv, pwrite, ftruncate, sysconf
+#include <fcntl.h>        // open, O_*
+#include <sys/types.h>    // pid_t
+#include <sys/wait.h>     // wait4, WIFEXITED, WEXITSTATUS
+#include <sys/resource.h> // rusage
+#include <sys/stat.h>     // mkdir
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>    // __rdtsc
+#endif
+#include <errno.h>        // errno, EEXIST
+
+#include <alias.h>        // bool, true, false
+#include <cli.h>          // parse_size
+
+//------------------------------------------------------------------------------
+// Aliases
+
+#define max_list   32
+#define max_keys   1000
+#define key_size   150000
+#define fill_block 1048576
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * I/O mode under test (extra vke arguments)
+ */
+typedef struct mode {
+  const char* name;
+  const char* args[3];
+} mode;
+
+/**
+ * Result of one benchmark case (median over its runs)
+ */
+typedef struct result {
+  double seconds;
+  double best;
+  unsigned long long cycles;
+  long peak_rss;
+  int status;
+} result;
+
+/**
+ * Benchmark settings
+ */
+typedef struct settings {
+  const char* vke;
+  const char* dir;
+  size_t sizes[max_list];
+  size_t size_count;
+  unsigned int keys[max_list];
+  size_t key_count;
+  const char* data[max_list];
+  size_t data_count;
+  const char* types[max_list];
+  size_t type_count;
+  const char* modes[max_list];
+  size_t mode_count;
+  unsigned int runs;
+} settings;
+
+//------------------------------------------------------------------------------
+// I/O modes
+
+char threads_arg[16];
+
+mode modes[] = {
+  { "stream",   { NULL } },
+  { "mmap",     { "-m", NULL } },
+  { "pipeline", { "-p", "8", NULL } },
+  { "uring",    { "-u", NULL } },
+  { "threads",  { "-t", threads_arg, NULL } },
+  { "direct",   { "--direct", NULL } },
+  { "v2",       { "-k", "2", NULL } }
+};
+
+//------------------------------------------------------------------------------
+// Utilities
+
+/**
+ * Split a comma separated argument in place
+ */
+size_t split_list(char* arg, const char** items) {
+  size_t count = 0;
+  char* next;
+
+  while (arg != NULL && count < max_list) {
+    items[count++] = arg;
+
+    if ((next = strchr(arg, ',')) != NULL) {
+      *next++ = '\0';
+    }
+    arg = next;
+  }
+  return count;
+}
+
+/**
+ * Monotonic wall clock in seconds
+ */
+double now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return time.tv_sec + (time.tv_nsec / 1e9);
+}
+
+/**
+ * Reference cycle counter (0 where there is none)
+ */
+unsigned long long cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Cheap incompressible bytes (xorshift64)
+ */
+void fill_random(char* buff, size_t length, unsigned long long* state) {
+  unsigned long long value = *state;
+  size_t indx;
+
+  for (indx = 0; indx + 8 <= length; indx += 8) {
+    value ^= value << 13;
+    value ^= value >> 7;
+    value ^= value << 17;
+    memcpy(buff + indx, &value, 8);
+  }
+  for (; indx < length; indx++) {
+    buff[indx] = (char) (value >> (indx % 8));
+  }
+  *state = value;
+}
+
+//------------------------------------------------------------------------------
+// Inputs
+
+/**
+ * Create a synthetic source
+ * - random: incompressible data written in full
+ * - sparse: a hole of the full size (reads as zeros, written blocks
+ *   get allocated by the run, so it is recreated before every run)
+ */
+bool make_source(const char* path, size_t size, const char* data) {
+  unsigned long long state = 0x9e3779b97f4a7c15ULL ^ size;
+  char* buff;
+  size_t offset;
+  size_t length;
+  int fd;
+
+  if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    fprintf(stderr, "Unable to create %s\n", path);
+    return false;
+  }
+  if (strcmp(data, "sparse") == 0) {
+    bool success = (ftruncate(fd, size) == 0);
+    close(fd);
+    return success;
+  }
+  if (!(buff = (char*) malloc(fill_block))) {
+    close(fd);
+    return false;
+  }
+
+  for (offset = 0; offset < size; offset += length) {
+    length = size - offset;
+    if (length > fill_block) {
+      length = fill_block;
+    }
+    fill_random(buff, length, &state);
+
+    if (pwrite(fd, buff, length, offset) != (ssize_t) length) {
+      fprintf(stderr, "Unable to write %s\n", path);
+      free(buff);
+      close(fd);
+      return false;
+    }
+  }
+  free(buff);
+  close(fd);
+  return true;
+}
+
+/**
+ * Build the key arguments for a key type
+ * - file: random key files of key_size bytes
+ * - short: text under the hash threshold (hashed)
+ * - long: text over the hash threshold (used as is)
+ */
+bool make_keys(settings* cfg, const char* type, unsigned int count,
+    char** keys) {
+  unsigned long long state = 0x2545f4914f6cdd1dULL;
+  char path[4096];
+  char* buff;
+  unsigned int indx;
+  size_t pos;
+  int fd;
+
+  for (indx = 0; indx < count; indx++) {
+    if (!(keys[indx] = (char*) malloc(4096))) {
+      return false;
+    }
+
+    if (strcmp(type, "file") == 0) {
+      snprintf(path, sizeof(path), "%s/key.%u", cfg->dir, indx);
+      snprintf(keys[indx], 4096, "%s", path);
+
+      if (access(path, R_OK) == 0) {
+        continue;
+      }
+      if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0
+          || !(buff = (char*) malloc(key_size))) {
+        fprintf(stderr, "Unable to create %s\n", path);
+        return false;
+      }
+      state += indx;
+      fill_random(buff, key_size, &state);
+
+      if (pwrite(fd, buff, key_size, 0) != key_size) {
+        fprintf(stderr, "Unable to write %s\n", path);
+        free(buff);
+        close(fd);
+        return false;
+      }
+      free(buff);
+      close(fd);
+    } else if (strcmp(type, "short") == 0) {
+      snprintf(keys[indx], 4096, "bench passphrase %u", indx);
+    } else {
+      for (pos = 0; pos < 300; pos++) {
+        keys[indx][pos] = 'a' + ((pos * 7 + indx) % 26);
+      }
+      keys[indx][pos] = '\0';
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Runs
+
+/**
+ * Run vke once and measure it
+ */
+bool run_case(settings* cfg, const char* source, mode* io, char** keys,
+    unsigned int count, double* seconds, unsigned long long* elapsed,
+    long* peak_rss, int* status) {
+  char* argv[max_keys + 8];
+  struct rusage usage;
+  double start;
+  unsigned long long first;
+  size_t argc = 0;
+  size_t indx;
+  pid_t pid;
+  int wstatus;
+
+  argv[argc++] = (char*) cfg->vke;
+  argv[argc++] = "-q";
+  for (indx = 0; io->args[indx] != NULL; indx++) {
+    argv[argc++] = (char*) io->args[indx];
+  }
+  argv[argc++] = (char*) source;
+  for (indx = 0; indx < count; indx++) {
+    argv[argc++] = keys[indx];
+  }
+  argv[argc] = NULL;
+
+  start = now();
+  first = cycles();
+
+  if ((pid = fork()) < 0) {
+    fprintf(stderr, "Unable to start %s\n", cfg->vke);
+    return false;
+  }
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    execv(cfg->vke, argv);
+    _exit(127);
+  }
+  if (wait4(pid, &wstatus, 0, &usage) < 0) {
+    return false;
+  }
+
+  *elapsed  = cycles() - first;
+  *seconds  = now() - start;
+  *peak_rss = usage.ru_maxrss;
+  *status   = (WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1);
+  return true;
+}
+
+/**
+ * Run one case cfg->runs times and keep the median
+ */
+bool bench_case(settings* cfg, size_t size, const char* data, mode* io,
+    char** keys, unsigned int count, result* res) {
+  char source[4096];
+  double seconds[max_list];
+  unsigned long long elapsed[max_list];
+  double swap_time;
+  unsigned long long swap_cycles;
+  unsigned int runs = cfg->runs;
+  unsigned int indx;
+  unsigned int next;
+
+  snprintf(source, sizeof(source), "%s/source.%s.%lu", cfg->dir, data, size);
+
+  res->peak_rss = 0;
+  res->status   = 0;
+
+  for (indx = 0; indx < runs; indx++) {
+    long peak_rss;
+    int status;
+
+    // Sparse sources get filled in by every run
+    if ((indx == 0 || strcmp(data, "sparse") == 0)
+        && !make_source(source, size, data)) {
+      return false;
+    }
+    if (!run_case(cfg, source, io, keys, count, &seconds[indx], &elapsed[indx],
+        &peak_rss, &status)) {
+      return false;
+    }
+    if (peak_rss > res->peak_rss) {
+      res->peak_rss = peak_rss;
+    }
+    if (status != 0) {
+      res->status = status;
+    }
+  }
+
+  // Order the runs by time (insertion sort, runs are few)
+  for (indx = 1; indx < runs; indx++) {
+    for (next = indx; next > 0 && seconds[next] < seconds[next - 1]; next--) {
+      swap_time           = seconds[next];
+      seconds[next]       = seconds[next - 1];
+      seconds[next - 1]   = swap_time;
+      swap_cycles         = elapsed[next];
+      elapsed[next]       = elapsed[next - 1];
+      elapsed[next - 1]   = swap_cycles;
+    }
+  }
+  res->seconds = seconds[runs / 2];
+  res->cycles  = elapsed[runs / 2];
+  res->best    = seconds[0];
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Execution gateway
+
+int main(int argc, char* argv[]) {
+  settings cfg;
+  char* keys[max_keys];
+  char sizes[256] = "1M,64M";
+  char counts[256] = "1,10,100";
+  char data[256] = "random,sparse";
+  char types[256] = "file,short,long";
+  char names[256] = "stream,mmap,pipeline,uring,threads";
+  const char* items[max_list];
+  bool first = true;
+  int arg_indx;
+  size_t s, d, t, k, m, indx;
+  result res;
+
+  cfg.vke  = "build/vke";
+  cfg.dir  = "/tmp";
+  cfg.runs = 3;
+  snprintf(threads_arg, sizeof(threads_arg), "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+
+  for (arg_indx = 1; arg_indx + 1 < argc; arg_indx += 2) {
+    char* value = argv[arg_indx + 1];
+
+    if (strcmp(argv[arg_indx], "--vke") == 0) {
+      cfg.vke = value;
+    } else if (strcmp(argv[arg_indx], "--dir") == 0) {
+      cfg.dir = value;
+    } else if (strcmp(argv[arg_indx], "--runs") == 0) {
+      cfg.runs = atoi(value);
+    } else if (strcmp(argv[arg_indx], "--sizes") == 0) {
+      strncpy(sizes, value, sizeof(sizes) - 1);
+    } else if (strcmp(argv[arg_indx], "--keys") == 0) {
+      strncpy(counts, value, sizeof(counts) - 1);
+    } else if (strcmp(argv[arg_indx], "--data") == 0) {
+      strncpy(data, value, sizeof(data) - 1);
+    } else if (strcmp(argv[arg_indx], "--types") == 0) {
+      strncpy(types, value, sizeof(types) - 1);
+    } else if (strcmp(argv[arg_indx], "--modes") == 0) {
+      strncpy(names, value, sizeof(names) - 1);
+    } else {
+      break;
+    }
+  }
+  if (arg_indx < argc || cfg.runs < 1 || cfg.runs > max_list) {
+    fprintf(stderr, "Usage: bench [--vke path] [--dir path] [--runs n] [--sizes 1M,64M,...]\n"
+        "             [--keys 1,10,...] [--data random,sparse] [--types file,short,long]\n"
+        "             [--modes stream,mmap,pipeline,uring,threads,direct,v2]\n");
+    return 1;
+  }
+
+  cfg.size_count = split_list(sizes, items);
+  for (indx = 0; indx < cfg.size_count; indx++) {
+    if (!(cfg.sizes[indx] = parse_size(items[indx]))) {
+      fprintf(stderr, "Invalid size %s\n", items[indx]);
+      return 1;
+    }
+  }
+  cfg.key_count = split_list(counts, items);
+  for (indx = 0; indx < cfg.key_count; indx++) {
+    cfg.keys[indx] = atoi(items[indx]);
+    if (cfg.keys[indx] < 1 || cfg.keys[indx] > max_keys) {
+      fprintf(stderr, "Invalid key count %s\n", items[indx]);
+      return 1;
+    }
+  }
+  if (mkdir(cfg.dir, 0700) < 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create %s\n", cfg.dir);
+    return 1;
+  }
+  cfg.data_count = split_list(data, cfg.data);
+  cfg.type_count = split_list(types, cfg.types);
+  cfg.mode_count = split_list(names, cfg.modes);
+
+  printf("[\n");
+
+  for (t = 0; t < cfg.type_count; t++) {
+    for (k = 0; k < cfg.key_count; k++) {
+      if (!make_keys(&cfg, cfg.types[t], cfg.keys[k], keys)) {
+        return 1;
+      }
+      for (s = 0; s < cfg.size_count; s++) {
+        for (d = 0; d < cfg.data_count; d++) {
+          for (m = 0; m < cfg.mode_count; m++) {
+            mode* io = NULL;
+
+            for (indx = 0; indx < sizeof(modes) / sizeof(*modes); indx++) {
+              if (strcmp(modes[indx].name, cfg.modes[m]) == 0) {
+                io = &modes[indx];
+              }
+            }
+            if (io == NULL) {
+              fprintf(stderr, "Unknown mode %s\n", cfg.modes[m]);
+              return 1;
+            }
+            fprintf(stderr, "%s keys=%u size=%lu data=%s mode=%s\n", cfg.types[t], cfg.keys[k], cfg.sizes[s], cfg.data[d], io->name);
+
+            if (!bench_case(&cfg, cfg.sizes[s], cfg.data[d], io, keys,
+                cfg.keys[k], &res)) {
+              return 1;
+            }
+
+            printf("%s  {\"size\": %lu, \"data\": \"%s\", \"keys\": %u, \"key_type\": \"%s\", \"mode\": \"%s\", \"runs\": %u, \"seconds\": %.6f, \"best_seconds\": %.6f, \"mb_per_s\": %.2f, \"bytes_per_cycle\": %.4f, \"peak_rss_kb\": %ld, \"status\": %d}",
+                (first ? "" : ",\n"), cfg.sizes[s], cfg.data[d], cfg.keys[k], cfg.types[t], io->name, cfg.runs, res.seconds, res.best,
+                (res.seconds > 0) ? (cfg.sizes[s] / 1048576.0) / res.seconds : 0,
+                (res.cycles > 0) ? (double) cfg.sizes[s] / res.cycles : 0,
+                res.peak_rss, res.status);
+            fflush(stdout);
+            first = false;
+          }
+        }
+      }
+      for (indx = 0; indx < cfg.keys[k]; indx++) {
+        free(keys[indx]);
+      }
+    }
+  }
+  printf("\n]\n");
+  return 0;
+}
@@ -0,0 +1,913 @@
+/**
+ ******************************************************************************
+ ***                                                                        ***
+ *               VKE   -   Hot kernel microbenchmark harness                  *
+ ***                                                                        ***
+ ******************************************************************************
+ */
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>        // printf, fprintf, stderr
+#include <stdlib.h>       // malloc, free, qsort, atoi, strtoull
+#include <string.h>       // memcpy, memcmp, memset, strcmp, strchr, strncpy
+#include <stdint.h>       // uint64_t
+#include <time.h>         // clock_gettime, CLOCK_MONOTONIC
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>    // __rdtsc
+#endif
+
+#include <data.h>         // obj
+#include <alias.h>        // key_block, bool, true, false
+#include <kernel.h>       // xor_kernel, sanitize_kernel, *_generic, *_sse2, ...
+#include <utility.h>      // fill_key_buffer
+#include <hash.h>         // hash_bytes, derive_key, derive_keys
+#include <sha3.h>         // sha3_ctx, rhash_sha3_*
+
+//------------------------------------------------------------------------------
+// Aliases
+
+#define max_list     32
+#define stream_pool  268435456
+#define sample_time  200000
+#define warmup_time  20000000
+#define sha3_rate    72
+#define derive_batch 8
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * One kernel under measurement
+ * - resident cases reuse one buffer, streaming cases walk a pool larger
+ *   than the last level cache so every call misses
+ */
+typedef struct bench_case {
+  const char* kernel;
+  const char* variant;
+  size_t size;
+  size_t bytes;
+  size_t align;
+  bool streaming;
+  char* pool;
+  char* key;
+  size_t offset;
+  xor_kernel xor_run;
+  sanitize_kernel sanitize_run;
+  obj text;
+  char* filled;
+  char* input;
+  char* material;
+  const char* texts[derive_batch];
+  size_t lengths[derive_batch];
+  char* materials[derive_batch];
+  size_t sizes[derive_batch];
+  sha3_ctx ctx;
+  uint64_t lanes[4 * sha3_max_permutation_size];
+  void (*permute)(uint64_t* state);
+} bench_case;
+
+typedef void (*bench_step)(bench_case* run);
+
+/**
+ * Kernel variant and the CPU feature it needs (NULL for none)
+ */
+typedef struct variant {
+  const char* name;
+  const char* feature;
+  void* run;
+} variant;
+
+//------------------------------------------------------------------------------
+// Variants
+
+variant xor_variants[] = {
+  { "generic", NULL,       (void*) xor_buffer_generic },
+#ifdef VKE_X86_KERNELS
+  { "sse2",    "sse2",     (void*) xor_buffer_sse2 },
+  { "avx2",    "avx2",     (void*) xor_buffer_avx2 },
+  { "avx512",  "avx512f",  (void*) xor_buffer_avx512 },
+#endif
+};
+
+variant sanitize_variants[] = {
+  { "generic", NULL,       (void*) sanitize_bytes_generic },
+#ifdef VKE_X86_KERNELS
+  { "sse4.1",  "sse4.1",   (void*) sanitize_bytes_sse41 },
+  { "avx2",    "avx2",     (void*) sanitize_bytes_avx2 },
+  { "avx512",  "avx512f",  (void*) sanitize_bytes_avx512 },
+#endif
+};
+
+variant sha3_variants[] = {
+  { "reference", NULL,    (void*) rhash_sha3_permutation_reference },
+  { "unrolled",  NULL,    (void*) rhash_sha3_permutation_unrolled },
+#ifdef RHASH_SHA3_X86
+  { "bmi2",      "bmi2",  (void*) rhash_sha3_permutation_bmi2 },
+#endif
+};
+
+variant sha3_x4_variants[] = {
+  { "generic",   NULL,    (void*) rhash_sha3_permutation_x4_generic },
+#ifdef RHASH_SHA3_X86
+  { "avx2",      "avx2",  (void*) rhash_sha3_permutation_x4_avx2 },
+#endif
+};
+
+#define variant_count(list) (sizeof(list) / sizeof(*(list)))
+
+//------------------------------------------------------------------------------
+// Utilities
+
+/**
+ * Whether the running CPU has a feature (__builtin_cpu_supports only
+ * takes literals)
+ */
+bool cpu_has(const char* feature) {
+  if (feature == NULL) {
+    return true;
+  }
+#ifdef VKE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (strcmp(feature, "sse2") == 0) {
+    return __builtin_cpu_supports("sse2");
+  } else if (strcmp(feature, "sse4.1") == 0) {
+    return __builtin_cpu_supports("sse4.1");
+  } else if (strcmp(feature, "avx2") == 0) {
+    return __builtin_cpu_supports("avx2");
+  } else if (strcmp(feature, "avx512f") == 0) {
+    return __builtin_cpu_supports("avx512f");
+  } else if (strcmp(feature, "bmi2") == 0) {
+    return __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2");
+  }
+#endif
+  return false;
+}
+
+/**
+ * Monotonic clock in nanoseconds
+ */
+uint64_t now() {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Reference cycle counter (0 where there is none)
+ */
+uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Cheap random bytes (xorshift64), never NUL when text is set
+ */
+void fill_random(char* buff, size_t length, uint64_t* state, bool text) {
+  uint64_t value = *state;
+  size_t indx;
+
+  for (indx = 0; indx < length; indx++) {
+    value ^= value << 13;
+    value ^= value >> 7;
+    value ^= value << 17;
+    buff[indx] = (char) value;
+
+    if (text && buff[indx] == '\0') {
+      buff[indx] = 'x';
+    }
+  }
+  *state = value;
+}
+
+int compare_samples(const void* left, const void* right) {
+  double a = *(const double*) left;
+  double b = *(const double*) right;
+
+  return (a > b) - (a < b);
+}
+
+/**
+ * Split a comma separated argument in place
+ */
+size_t split_list(char* arg, const char** items) {
+  size_t count = 0;
+  char* next;
+
+  while (arg != NULL && count < max_list) {
+    items[count++] = arg;
+
+    if ((next = strchr(arg, ',')) != NULL) {
+      *next++ = '\0';
+    }
+    arg = next;
+  }
+  return count;
+}
+
+//------------------------------------------------------------------------------
+// Reference implementations
+
+void xor_reference(char* buff, const char* key, size_t length) {
+  size_t indx;
+
+  for (indx = 0; indx < length; indx++) {
+    buff[indx] ^= key[indx];
+  }
+}
+
+/**
+ * The original sanitize_buffer loop (with defined overflow)
+ */
+void sanitize_reference(char* buff, int indx, int length, int key_read) {
+  int index;
+
+  for (index = 0; index < length; index++) {
+    buff[index] = (int)((unsigned int)(buff[index] + indx + index) * (unsigned int)key_read) % 255;
+
+    if (buff[index] == 0) {
+      buff[index] = 1;
+    }
+  }
+}
+
+/**
+ * The original text key derivation (get_hash over a leaked context, then
+ * strlen / strcat over the results)
+ */
+char* legacy_hash(char* input) {
+  sha3_ctx* ctx = malloc(sizeof(sha3_ctx));
+
+  rhash_sha3_512_init(ctx);
+  rhash_sha3_update(ctx, (const unsigned char*) input, strlen(input));
+  rhash_sha3_final(ctx, NULL);
+
+  return (char*) ctx->hash;
+}
+
+size_t derive_reference(const char* text, char* material) {
+  size_t length = strlen(text);
+  char* reverse = (char*) malloc(length + 1);
+  char* hash;
+  char* rev_hash;
+  size_t indx;
+
+  for (indx = 0; indx < length; indx++) {
+    reverse[indx] = text[length - 1 - indx];
+  }
+  reverse[length] = '\0';
+
+  hash     = legacy_hash((char*) text);
+  rev_hash = legacy_hash(reverse);
+
+  material[0] = '\0';
+  strcat(material, hash);
+  strcat(material, rev_hash);
+
+  free(hash);
+  free(rev_hash);
+  free(reverse);
+  return strlen(material);
+}
+
+//------------------------------------------------------------------------------
+// Cross checks
+
+/**
+ * Every XOR and sanitize variant against the reference, over lengths
+ * around the vector widths and misaligned buffers
+ */
+bool verify_vectors() {
+  size_t lengths[] = { 1023, 1024, 1025, 4113, key_block };
+  int indices[]    = { 0, 5, 102390 };
+  int key_reads[]  = { 1, 199, 255, 256, 102399, key_block };
+  size_t count     = 300 + (sizeof(lengths) / sizeof(*lengths));
+  char* expect     = (char*) malloc(key_block + 64);
+  char* actual     = (char*) malloc(key_block + 64);
+  char* key        = (char*) malloc(key_block + 64);
+  uint64_t state   = 0x9e3779b97f4a7c15ULL;
+  size_t test, length, align, indx, pass;
+  bool success = true;
+
+  for (test = 0; success && test < count; test++) {
+    length = (test < 300) ? test : lengths[test - 300];
+
+    for (align = 0; success && align < 64; align += 7) {
+      for (indx = 0; success && indx < variant_count(xor_variants); indx++) {
+        if (!cpu_has(xor_variants[indx].feature)) {
+          continue;
+        }
+        fill_random(expect, length + align, &state, false);
+        fill_random(key, length + 3, &state, false);
+        memcpy(actual, expect, length + align);
+
+        xor_reference(expect + align, key + 3, length);
+        ((xor_kernel) xor_variants[indx].run)(actual + align, key + 3, length);
+
+        if (memcmp(expect, actual, length + align) != 0) {
+          fprintf(stderr, "Mismatch in xor %s (length %lu, align %lu)\n", xor_variants[indx].name, length, align);
+          success = false;
+        }
+      }
+      for (indx = 0; success && indx < variant_count(sanitize_variants); indx++) {
+        if (!cpu_has(sanitize_variants[indx].feature)) {
+          continue;
+        }
+        for (pass = 0; success && pass < 18; pass++) {
+          int start    = indices[pass % 3];
+          int key_read = key_reads[pass / 3];
+
+          fill_random(expect, length + align, &state, false);
+          memcpy(actual, expect, length + align);
+
+          sanitize_reference(expect + align, start, length, key_read);
+          ((sanitize_kernel) sanitize_variants[indx].run)(actual + align, start, length, key_read);
+
+          if (memcmp(expect, actual, length + align) != 0) {
+            fprintf(stderr, "Mismatch in sanitize %s (length %lu, align %lu, index %d, key %d)\n",
+                sanitize_variants[indx].name, length, align, start, key_read);
+            success = false;
+          }
+        }
+      }
+    }
+  }
+  free(expect);
+  free(actual);
+  free(key);
+  return success;
+}
+
+/**
+ * fill_key_buffer repeats the text up to key_block - 1 bytes
+ */
+bool verify_fill() {
+  size_t lengths[] = { 1, 2, 63, 128, 1000, key_block - 2, key_block - 1 };
+  char* text     = (char*) malloc(key_block);
+  char* filled   = (char*) malloc(key_block);
+  uint64_t state = 0x2545f4914f6cdd1dULL;
+  size_t test, indx, size;
+  bool success = true;
+  obj key;
+
+  memset(&key, 0, sizeof(key));
+  key.buff = text;
+
+  for (test = 0; success && test < sizeof(lengths) / sizeof(*lengths); test++) {
+    fill_random(text, lengths[test], &state, true);
+    key.length = lengths[test];
+
+    size = fill_key_buffer(&key, filled);
+
+    for (indx = 0; indx < key_block - 1; indx++) {
+      if (filled[indx] != text[indx % lengths[test]]) {
+        break;
+      }
+    }
+    if (indx < key_block - 1 || filled[key_block - 1] != '\0' || size != key_block - 1
+        || fill_key_buffer(&key, NULL) != size) {
+      fprintf(stderr, "Mismatch in fill_key_buffer (length %lu)\n", lengths[test]);
+      success = false;
+    }
+  }
+  free(filled);
+  free(text);
+  return success;
+}
+
+/**
+ * Every Keccak-f[1600] permutation variant against the reference, over
+ * random states (single and four interleaved)
+ */
+bool verify_permutations() {
+  uint64_t states[4][sha3_max_permutation_size];
+  uint64_t expect[4 * sha3_max_permutation_size];
+  uint64_t actual[4 * sha3_max_permutation_size];
+  uint64_t state = 0xda942042e4dd58b5ULL;
+  size_t test, indx, lane, n;
+  bool success = true;
+
+  for (test = 0; success && test < 1000; test++) {
+    // Lane i of state n sits at 4 * i + n in the interleaved layout
+    for (n = 0; n < 4; n++) {
+      fill_random((char*) states[n], sizeof(states[n]), &state, false);
+
+      for (lane = 0; lane < sha3_max_permutation_size; lane++) {
+        actual[4 * lane + n] = states[n][lane];
+      }
+      rhash_sha3_permutation_reference(states[n]);
+
+      for (lane = 0; lane < sha3_max_permutation_size; lane++) {
+        expect[4 * lane + n] = states[n][lane];
+      }
+    }
+
+    for (indx = 0; success && indx < variant_count(sha3_x4_variants); indx++) {
+      uint64_t lanes[4 * sha3_max_permutation_size];
+
+      if (!cpu_has(sha3_x4_variants[indx].feature)) {
+        continue;
+      }
+      memcpy(lanes, actual, sizeof(lanes));
+      ((void (*)(uint64_t*)) sha3_x4_variants[indx].run)(lanes);
+
+      if (memcmp(expect, lanes, sizeof(lanes)) != 0) {
+        fprintf(stderr, "Mismatch in sha3_permutation_x4 %s\n", sha3_x4_variants[indx].name);
+        success = false;
+      }
+    }
+
+    for (indx = 0; success && indx < variant_count(sha3_variants); indx++) {
+      uint64_t lanes[sha3_max_permutation_size];
+
+      if (!cpu_has(sha3_variants[indx].feature)) {
+        continue;
+      }
+      for (lane = 0; lane < sha3_max_permutation_size; lane++) {
+        lanes[lane] = actual[4 * lane];
+      }
+      ((void (*)(uint64_t*)) sha3_variants[indx].run)(lanes);
+
+      if (memcmp(states[0], lanes, sizeof(lanes)) != 0) {
+        fprintf(stderr, "Mismatch in sha3_permutation %s\n", sha3_variants[indx].name);
+        success = false;
+      }
+    }
+  }
+  return success;
+}
+
+/**
+ * derive_key and derive_keys against the original derivation, over every
+ * text length up to a few blocks and odd batch sizes
+ * - about half of all hashes have no NUL in the state and run on into the
+ *   final message block, so every branch is taken
+ */
+bool verify_derive() {
+  char* texts[derive_batch];
+  char* materials[derive_batch];
+  char expect[derive_batch][key_material];
+  size_t lengths[derive_batch];
+  size_t sizes[derive_batch];
+  size_t expect_sizes[derive_batch];
+  uint64_t state = 0x14057b7ef767814fULL;
+  size_t length, count, indx;
+  bool success = true;
+
+  for (indx = 0; indx < derive_batch; indx++) {
+    texts[indx]     = (char*) malloc(key_material);
+    materials[indx] = (char*) malloc(key_material);
+  }
+
+  for (length = 0; success && length < 4 * sha3_rate; length++) {
+    for (count = 1; success && count <= derive_batch; count += 2) {
+      for (indx = 0; indx < count; indx++) {
+        lengths[indx] = (length + (indx * 37)) % (4 * sha3_rate);
+        fill_random(texts[indx], lengths[indx], &state, true);
+        texts[indx][lengths[indx]] = '\0';
+
+        expect_sizes[indx] = derive_reference(texts[indx], expect[indx]);
+      }
+
+      derive_keys((const char**) texts, lengths, materials, sizes, count);
+
+      for (indx = 0; success && indx < count; indx++) {
+        if (sizes[indx] != expect_sizes[indx]
+            || memcmp(materials[indx], expect[indx], sizes[indx] + 1) != 0) {
+          fprintf(stderr, "Mismatch in derive_keys (length %lu, batch %lu)\n", lengths[indx], count);
+          success = false;
+        }
+      }
+
+      // In place, as initialize does it
+      memcpy(materials[0], texts[0], lengths[0] + 1);
+      sizes[0] = derive_key(materials[0], lengths[0], materials[0]);
+
+      if (success && (sizes[0] != expect_sizes[0]
+          || memcmp(materials[0], expect[0], sizes[0] + 1) != 0)) {
+        fprintf(stderr, "Mismatch in derive_key (length %lu)\n", lengths[0]);
+        success = false;
+      }
+    }
+  }
+
+  for (indx = 0; indx < derive_batch; indx++) {
+    free(texts[indx]);
+    free(materials[indx]);
+  }
+  return success;
+}
+
+/**
+ * SHA3-512 known answers (FIPS 202), split and misaligned updates and the
+ * Keccak-f[1600] permutation of the zero state
+ */
+bool verify_sha3() {
+  static const unsigned char abc[sha3_512_hash_size] = {
+    0xb7, 0x51, 0x85, 0x0b, 0x1a, 0x57, 0x16, 0x8a, 0x56, 0x93, 0xcd, 0x92, 0x4b, 0x6b, 0x09, 0x6e,
+    0x08, 0xf6, 0x21, 0x82, 0x74, 0x44, 0xf7, 0x0d, 0x88, 0x4f, 0x5d, 0x02, 0x40, 0xd2, 0x71, 0x2e,
+    0x10, 0xe1, 0x16, 0xe9, 0x19, 0x2a, 0xf3, 0xc9, 0x1a, 0x7e, 0xc5, 0x76, 0x47, 0xe3, 0x93, 0x40,
+    0x57, 0x34, 0x0b, 0x4c, 0xf4, 0x08, 0xd5, 0xa5, 0x65, 0x92, 0xf8, 0x27, 0x4e, 0xec, 0x53, 0xf0
+  };
+  static const unsigned char empty[sha3_512_hash_size] = {
+    0xa6, 0x9f, 0x73, 0xcc, 0xa2, 0x3a, 0x9a, 0xc5, 0xc8, 0xb5, 0x67, 0xdc, 0x18, 0x5a, 0x75, 0x6e,
+    0x97, 0xc9, 0x82, 0x16, 0x4f, 0xe2, 0x58, 0x59, 0xe0, 0xd1, 0xdc, 0xc1, 0x47, 0x5c, 0x80, 0xa6,
+    0x15, 0xb2, 0x12, 0x3a, 0xf1, 0xf5, 0xf9, 0x4c, 0x11, 0xe3, 0xe9, 0x40, 0x2c, 0x3a, 0xc5, 0x58,
+    0xf5, 0x00, 0x19, 0x9d, 0x95, 0xb6, 0xd3, 0xe3, 0x01, 0x75, 0x85, 0x86, 0x28, 0x1d, 0xcd, 0x26
+  };
+  unsigned char expect[sha3_512_hash_size];
+  unsigned char actual[sha3_512_hash_size];
+  char* message  = (char*) malloc(4096 + 8);
+  uint64_t state = 0x5851f42d4c957f2dULL;
+  uint64_t lanes[25];
+  size_t cut;
+  bool success = true;
+  sha3_ctx ctx;
+
+  hash_bytes(&ctx, "abc", 3, actual);
+  if (memcmp(actual, abc, sizeof(abc)) != 0) {
+    fprintf(stderr, "Mismatch in hash_bytes (\"abc\")\n");
+    success = false;
+  }
+
+  hash_bytes(&ctx, "", 0, actual);
+  if (memcmp(actual, empty, sizeof(empty)) != 0) {
+    fprintf(stderr, "Mismatch in hash_bytes (\"\")\n");
+    success = false;
+  }
+
+  fill_random(message, 4096 + 8, &state, false);
+  rhash_sha3_512_init(&ctx);
+  rhash_sha3_update(&ctx, (unsigned char*) message, 4096);
+  rhash_sha3_final(&ctx, expect);
+
+  for (cut = 1; success && cut < 4096; cut = cut * 3 + 1) {
+    rhash_sha3_512_init(&ctx);
+    rhash_sha3_update(&ctx, (unsigned char*) message, cut);
+    rhash_sha3_update(&ctx, (unsigned char*) message + cut, 4096 - cut);
+    rhash_sha3_final(&ctx, actual);
+
+    if (memcmp(expect, actual, sizeof(expect)) != 0) {
+      fprintf(stderr, "Mismatch in rhash_sha3_update (split at %lu)\n", cut);
+      success = false;
+    }
+  }
+
+  memmove(message + 5, message, 4096);
+  rhash_sha3_512_init(&ctx);
+  rhash_sha3_update(&ctx, (unsigned char*) message + 5, 4096);
+  rhash_sha3_final(&ctx, actual);
+
+  if (memcmp(expect, actual, sizeof(expect)) != 0) {
+    fprintf(stderr, "Mismatch in rhash_sha3_update (misaligned)\n");
+    success = false;
+  }
+
+  memset(lanes, 0, sizeof(lanes));
+  rhash_sha3_permutation(lanes);
+
+  if (lanes[0] != 0xF1258F7940E1DDE7ULL || lanes[1] != 0x84D5CCF933C0478AULL
+      || lanes[24] != 0xEAF1FF7B5CECA249ULL) {
+    fprintf(stderr, "Mismatch in rhash_sha3_permutation\n");
+    success = false;
+  }
+  free(message);
+  return success;
+}
+
+//------------------------------------------------------------------------------
+// Kernel steps
+
+/**
+ * Next data buffer for a case
+ */
+char* next_buffer(bench_case* run) {
+  char* buff = run->pool + run->offset + run->align;
+
+  if (run->streaming) {
+    run->offset += (run->size + 63) & ~((size_t) 63);
+
+    if (run->offset + run->size + 64 > stream_pool) {
+      run->offset = 0;
+    }
+  }
+  return buff;
+}
+
+void step_xor(bench_case* run) {
+  run->xor_run(next_buffer(run), run->key + run->align, run->size);
+}
+
+void step_sanitize(bench_case* run) {
+  run->sanitize_run(next_buffer(run), 0, run->size, run->size);
+}
+
+void step_fill(bench_case* run) {
+  run->text.buff   = run->input;
+  run->text.length = run->size;
+  fill_key_buffer(&run->text, run->filled);
+}
+
+void step_hash(bench_case* run) {
+  unsigned char digest[sha3_512_hash_size];
+
+  hash_bytes(&run->ctx, run->input, run->size, digest);
+}
+
+void step_derive(bench_case* run) {
+  derive_key(run->input, run->size, run->material);
+}
+
+void step_derive_legacy(bench_case* run) {
+  derive_reference(run->input, run->material);
+}
+
+void step_derive_batch(bench_case* run) {
+  derive_keys(run->texts, run->lengths, run->materials, run->sizes, derive_batch);
+}
+
+void step_update(bench_case* run) {
+  rhash_sha3_update(&run->ctx, (unsigned char*) next_buffer(run), run->size);
+}
+
+void step_permutation(bench_case* run) {
+  run->permute(run->ctx.hash);
+}
+
+void step_permutation_x4(bench_case* run) {
+  run->permute(run->lanes);
+}
+
+//------------------------------------------------------------------------------
+// Measurement
+
+/**
+ * Warm up, size the batches to sample_time and print the summary
+ * - each sample is the mean over one batch of calls, the median and p99
+ *   are over samples
+ */
+void measure(bench_case* run, bench_step step, size_t samples, bool* first) {
+  double* times    = (double*) malloc(samples * sizeof(double));
+  double* counts   = (double*) malloc(samples * sizeof(double));
+  uint64_t start   = now();
+  uint64_t calls   = 0;
+  uint64_t reps;
+  uint64_t begin;
+  uint64_t ticks;
+  size_t indx;
+  size_t tail;
+
+  while (calls < 3 || now() - start < warmup_time) {
+    step(run);
+    calls++;
+  }
+  reps = (sample_time * calls) / (now() - start);
+  if (reps < 1) {
+    reps = 1;
+  }
+
+  for (indx = 0; indx < samples; indx++) {
+    uint64_t rep;
+
+    begin = now();
+    ticks = cycles();
+
+    for (rep = 0; rep < reps; rep++) {
+      step(run);
+    }
+    counts[indx] = (double) (cycles() - ticks) / reps;
+    times[indx]  = (double) (now() - begin) / reps;
+  }
+
+  qsort(times, samples, sizeof(double), compare_samples);
+  qsort(counts, samples, sizeof(double), compare_samples);
+  tail = ((samples * 99) + 99) / 100 - 1;
+
+  printf("%s  {\"kernel\": \"%s\", \"variant\": \"%s\", \"size\": %lu, \"align\": %lu, \"set\": \"%s\", \"samples\": %lu, \"reps\": %lu, \"median_ns\": %.2f, \"p99_ns\": %.2f, \"cycles_per_byte\": %.4f, \"mb_per_s\": %.2f}",
+      (*first ? "" : ",\n"), run->kernel, run->variant, run->size, run->align, (run->streaming ? "streaming" : "resident"),
+      samples, reps, times[samples / 2], times[tail], counts[samples / 2] / run->bytes,
+      (times[samples / 2] > 0) ? (run->bytes / 1048576.0) / (times[samples / 2] / 1e9) : 0);
+  fflush(stdout);
+  *first = false;
+
+  free(times);
+  free(counts);
+}
+
+//------------------------------------------------------------------------------
+// Execution gateway
+
+int main(int argc, char* argv[]) {
+  size_t aligns[]  = { 0, 1, 33 };
+  size_t inputs[]  = { 16, 128, 1000, 50000 };
+  size_t hashes[]  = { 16, 64, 199, 1024, 102400 };
+  size_t texts[]   = { 8, 64, 199 };
+  char sizes[256]  = "64,1024,16384,102400,1048576,16777216";
+  char kernels[256] = "xor,sanitize,fill_key_buffer,hash_bytes,derive_key,derive_keys,"
+                      "sha3_update,sha3_permutation,sha3_permutation_x4";
+  const char* items[max_list];
+  const char* names[max_list];
+  size_t lengths[max_list];
+  size_t length_count;
+  size_t name_count;
+  size_t samples = 51;
+  size_t s, a, v, k, set;
+  uint64_t state = 0x853c49e6748fea9bULL;
+  bool first = true;
+  bench_case run;
+  int arg_indx;
+
+  for (arg_indx = 1; arg_indx + 1 < argc; arg_indx += 2) {
+    if (strcmp(argv[arg_indx], "--samples") == 0) {
+      samples = atoi(argv[arg_indx + 1]);
+    } else if (strcmp(argv[arg_indx], "--sizes") == 0) {
+      strncpy(sizes, argv[arg_indx + 1], sizeof(sizes) - 1);
+    } else if (strcmp(argv[arg_indx], "--kernels") == 0) {
+      strncpy(kernels, argv[arg_indx + 1], sizeof(kernels) - 1);
+    } else {
+      break;
+    }
+  }
+  if (arg_indx < argc || samples < 1) {
+    fprintf(stderr, "Usage: kernels [--samples n] [--sizes 64,1024,...]\n"
+        "               [--kernels xor,sanitize,fill_key_buffer,hash_bytes,derive_key,\n"
+        "                          derive_keys,sha3_update,sha3_permutation,sha3_permutation_x4]\n");
+    return 1;
+  }
+  length_count = split_list(sizes, items);
+  for (s = 0; s < length_count; s++) {
+    lengths[s] = strtoull(items[s], NULL, 10);
+
+    if (lengths[s] < 1 || lengths[s] > stream_pool / 4) {
+      fprintf(stderr, "Invalid size %s\n", items[s]);
+      return 1;
+    }
+  }
+  name_count = split_list(kernels, names);
+
+  init_kernels();
+
+  if (!verify_vectors() || !verify_fill() || !verify_permutations() || !verify_sha3()
+      || !verify_derive()) {
+    return 1;
+  }
+  fprintf(stderr, "All kernel variants match the reference (dispatch: xor %s, sanitize %s, sha3 %s)\n",
+      xor_kernel_name(), sanitize_kernel_name(), sha3_kernel_name());
+
+  memset(&run, 0, sizeof(run));
+  run.pool        = (char*) malloc(stream_pool);
+  run.key         = (char*) malloc(stream_pool / 4 + 64);
+  run.input       = (char*) malloc(key_block + 1);
+  run.filled      = (char*) malloc(key_block);
+  run.material    = (char*) malloc(derive_batch * key_material);
+
+  if (!run.pool || !run.key || !run.input || !run.filled || !run.material) {
+    fprintf(stderr, "Unable to allocate buffers\n");
+    return 1;
+  }
+  fill_random(run.pool, stream_pool, &state, false);
+  fill_random(run.key, stream_pool / 4 + 64, &state, false);
+
+  printf("[\n");
+
+  for (k = 0; k < name_count; k++) {
+    const char* kernel = names[k];
+
+    run.kernel = kernel;
+    run.offset = 0;
+
+    if (strcmp(kernel, "xor") == 0 || strcmp(kernel, "sanitize") == 0) {
+      bool is_xor     = (strcmp(kernel, "xor") == 0);
+      variant* list   = is_xor ? xor_variants : sanitize_variants;
+      size_t count    = is_xor ? variant_count(xor_variants) : variant_count(sanitize_variants);
+
+      for (v = 0; v < count; v++) {
+        if (!cpu_has(list[v].feature)) {
+          continue;
+        }
+        run.variant      = list[v].name;
+        run.xor_run      = (xor_kernel) list[v].run;
+        run.sanitize_run = (sanitize_kernel) list[v].run;
+
+        for (s = 0; s < length_count; s++) {
+          for (a = 0; a < sizeof(aligns) / sizeof(*aligns); a++) {
+            for (set = 0; set < 2; set++) {
+              run.size      = lengths[s];
+              run.bytes     = lengths[s];
+              run.align     = aligns[a];
+              run.streaming = set;
+              run.offset    = 0;
+              measure(&run, is_xor ? step_xor : step_sanitize, samples, &first);
+            }
+          }
+        }
+      }
+    } else if (strcmp(kernel, "fill_key_buffer") == 0) {
+      run.variant   = "generic";
+      run.align     = 0;
+      run.streaming = false;
+
+      for (s = 0; s < sizeof(inputs) / sizeof(*inputs); s++) {
+        fill_random(run.input, inputs[s], &state, true);
+        run.input[inputs[s]] = '\0';
+        run.size  = inputs[s];
+        run.bytes = key_block - 1;
+        measure(&run, step_fill, samples, &first);
+      }
+    } else if (strcmp(kernel, "hash_bytes") == 0) {
+      run.variant   = "generic";
+      run.align     = 0;
+      run.streaming = false;
+
+      for (s = 0; s < sizeof(hashes) / sizeof(*hashes); s++) {
+        fill_random(run.input, hashes[s], &state, true);
+        run.size  = hashes[s];
+        run.bytes = hashes[s];
+        measure(&run, step_hash, samples, &first);
+      }
+    } else if (strcmp(kernel, "derive_key") == 0 || strcmp(kernel, "derive_keys") == 0) {
+      // Text keys below the default hash threshold (200)
+      bool is_batch = (strcmp(kernel, "derive_keys") == 0);
+
+      run.align     = 0;
+      run.streaming = false;
+
+      for (s = 0; s < sizeof(texts) / sizeof(*texts); s++) {
+        fill_random(run.input, texts[s], &state, true);
+        run.input[texts[s]] = '\0';
+        run.size = texts[s];
+
+        if (is_batch) {
+          for (v = 0; v < derive_batch; v++) {
+            run.texts[v]     = run.input;
+            run.lengths[v]   = texts[s];
+            run.materials[v] = run.material + (v * key_material);
+          }
+          run.variant = "batch";
+          run.bytes   = derive_batch * texts[s];
+          measure(&run, step_derive_batch, samples, &first);
+        } else {
+          run.bytes   = texts[s];
+          run.variant = "legacy";
+          measure(&run, step_derive_legacy, samples, &first);
+          run.variant = "generic";
+          measure(&run, step_derive, samples, &first);
+        }
+      }
+    } else if (strcmp(kernel, "sha3_update") == 0) {
+      run.variant = "generic";
+
+      for (s = 0; s < length_count; s++) {
+        for (a = 0; a < 2; a++) {
+          for (set = 0; set < 2; set++) {
+            rhash_sha3_512_init(&run.ctx);
+            run.size      = lengths[s];
+            run.bytes     = lengths[s];
+            run.align     = aligns[a];
+            run.streaming = set;
+            run.offset    = 0;
+            measure(&run, step_update, samples, &first);
+          }
+        }
+      }
+    } else if (strcmp(kernel, "sha3_permutation") == 0
+        || strcmp(kernel, "sha3_permutation_x4") == 0) {
+      // Cycles per byte of the SHA3-512 rate (one block per permutation)
+      bool is_x4    = (strcmp(kernel, "sha3_permutation_x4") == 0);
+      variant* list = is_x4 ? sha3_x4_variants : sha3_variants;
+      size_t count  = is_x4 ? variant_count(sha3_x4_variants) : variant_count(sha3_variants);
+
+      for (v = 0; v < count; v++) {
+        if (!cpu_has(list[v].feature)) {
+          continue;
+        }
+        rhash_sha3_512_init(&run.ctx);
+        memset(run.lanes, 0, sizeof(run.lanes));
+        run.variant   = list[v].name;
+        run.permute   = (void (*)(uint64_t*)) list[v].run;
+        run.size      = is_x4 ? sizeof(run.lanes) : sizeof(run.ctx.hash);
+        run.bytes     = is_x4 ? 4 * sha3_rate : sha3_rate;
+        run.align     = 0;
+        run.streaming = false;
+        measure(&run, is_x4 ? step_permutation_x4 : step_permutation, samples, &first);
+      }
+    } else {
+      fprintf(stderr, "Unknown kernel %s\n", kernel);
+      return 1;
+    }
+  }
+  printf("\n]\n");
+
+  free(run.pool);
+  free(run.key);
+  free(run.input);
+  free(run.filled);
+  free(run.material);
+  return 0;
+}
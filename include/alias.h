@@ -4,7 +4,71 @@
 //------------------------------------------------------------------------------
 // Aliases
 
-#define buff_size 102400
+#define buff_size   102400
+#define key_block   102400
+#define huge_page   2097152
+#define map_size    1073741824
+#define queue_depth 8
+#define task_span   67108864
+#define task_files  64
+#define key_share   64
+#define key_group   4
+#define pipe_size   1048576
+#define page_align  4096
+#define arena_size  65536
+#define arena_align 16
+
+#define hash_rate    72
+#define hash_part    272
+#define key_material 545
+
+#define progress_interval 1000
+
+#define chunk_idle    0
+#define chunk_reading 1
+#define chunk_ready   2
+#define chunk_writing 3
+
+#define task_directory 0
+#define task_range     1
+#define task_batch     2
+
+#define phase_init     0
+#define phase_hash     1
+#define phase_check    2
+#define phase_verify   3
+#define phase_combine  4
+#define phase_read     5
+#define phase_write    6
+#define phase_uring    7
+#define phase_compute  8
+#define phase_close    9
+#define phase_count    10
+
+#define call_read  0
+#define call_write 1
+#define call_sync  2
+#define call_uring 3
+#define call_map   4
+#define call_other 5
+#define call_count 6
+
+#define perf_key_init    0
+#define perf_hash        1
+#define perf_verify      2
+#define perf_sanitize    3
+#define perf_xor         4
+#define perf_io          5
+#define perf_stage_count 6
+
+#define perf_cycles        0
+#define perf_instructions  1
+#define perf_llc_misses    2
+#define perf_branch_misses 3
+#define perf_dtlb_misses   4
+#define perf_task_clock    5
+#define perf_counter_count 6
+
 #define true 1
 #define false 0
 
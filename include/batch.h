@@ -0,0 +1,23 @@
+#ifndef VKE_BATCH_DEFINED
+#define VKE_BATCH_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <alias.h>  // bool
+#include <data.h>   // config, obj, cursor, batch
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool add_source(config* cfg, const char* name);
+bool load_sources(config* cfg, const char* list);
+void free_sources(config* cfg);
+
+bool combine_batch(config* cfg);
+bool unique_sources(config* cfg);
+void* batch_worker(void* data);
+bool combine_source(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end);
+
+#endif
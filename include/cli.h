@@ -2,9 +2,15 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
+#include <alias.h>  // bool
 #include <data.h>   // config
 
 //------------------------------------------------------------------------------
 // Function prototypes
 
+size_t parse_size(const char* arg);
+unsigned int parse_count(const char* arg, unsigned int high);
+int parse_fd(const char* arg);
+bool option_value(const char* arg);
+bool stream_source(int argc, char* argv[]);
 void process_args(config* cfg, int argc, char* argv[]);
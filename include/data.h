@@ -4,39 +4,82 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdio.h> // FILE
-#include <time.h>  // clock_t
+#include <stdint.h>    // uint64_t
+#include <pthread.h>   // pthread_t
+#include <stdatomic.h> // atomic_bool, atomic_size_t, atomic_uint_least64_t
 
-#include <alias.h> // bool
+#include <alias.h>     // bool
+#include <io.h>        // vke_io
+#include <ring.h>      // ring
+#include <deque.h>     // deque
+#include <fileset.h>   // fileset
+#include <pool.h>      // arena, pool
 
 //------------------------------------------------------------------------------
 // Data structures
 
 /**
  * Data object (source and key files/text)
+ * - sources hold a pool buffer, text keys only their material (length
+ *   bytes, size is the length of the key stream period) and file keys
+ *   nothing but the open file
+ * - passes is how far a version 1 text key is advanced when a cursor on
+ *   it starts at the beginning of the source
  */
 typedef struct obj {
   char* name;
   bool initialized;
   bool is_file;
-  FILE* data;
+  vke_io io;
+  vke_io* out;
   size_t size;
+  size_t length;
+  size_t passes;
   size_t indx;
   char* buff;
-  char* hash;
-  char* rev_str;
-  char* rev_hash;
-  char* final_hash;
 } obj;
 
 /**
- * Linked encryption layer (processed argument)
+ * One SHA3-512 sponge of a key derivation batch (the text is read
+ * backwards for the reversed hash)
+ */
+typedef struct sponge {
+  const char* text;
+  size_t length;
+  bool reverse;
+  size_t blocks;
+  char* material;
+  size_t size;
+} sponge;
+
+/**
+ * Position in the sanitized key stream of a key
+ * - buff holds the key bytes loaded last (read bytes, indx of them used),
+ *   the chunk of a version 1 text key or else the scratch buffer the
+ *   cursors of a set share
+ * - offset is the stream position of the next load
+ */
+typedef struct cursor {
+  obj* key;
+  struct layer* layr;
+  unsigned int version;
+  char* scratch;
+  char* buff;
+  size_t read;
+  size_t indx;
+  size_t offset;
+} cursor;
+
+/**
+ * Encryption layer (processed argument or manifest line)
+ * - times (nanoseconds, per phase_*) and bytes are kept for --stats
  */
 typedef struct layer {
   char* name;
   unsigned int indx;
   obj* key;
-  struct layer* next;
+  atomic_uint_least64_t times[phase_count];
+  atomic_uint_least64_t bytes;
 } layer;
 
 /**
@@ -47,11 +90,219 @@ typedef struct config {
   bool show_version;
   bool dry_run;
   bool quiet;
+  bool mmap;
+  bool deep_check;
   unsigned int hash_threshold;
+  unsigned int keystream;
+  size_t buffer_size;
+  unsigned int threads;
+  unsigned int pipeline;
+  bool uring;
+  bool sqpoll;
+  bool direct;
+  char* output;
+  char* output_path;
+  char* output_temp;
+  bool batch;
+  bool recursive;
+  bool stream;
+  char** sources;
+  size_t source_length;
+  size_t source_capacity;
   size_t src_indx;
   size_t key_length;
+  size_t key_capacity;
   struct layer* keys;
-  clock_t start;
+  arena memory;
+  pool buffers;
+  bool stats;
+  bool progress;
+  int progress_fd;
+  bool perf_counters;
+  uint64_t start;
 } config;
 
+/**
+ * Runtime statistics (--stats json), shared by every thread
+ * - phase times are monotonic nanoseconds summed over the threads that
+ *   spent them, so I/O waits and compute can add up to more than wall time
+ */
+typedef struct stats {
+  bool enabled;
+  bool counting;
+  uint64_t start;
+  atomic_uint_least64_t times[phase_count];
+  atomic_uint_least64_t calls[call_count];
+  atomic_uint_least64_t bytes_read;
+  atomic_uint_least64_t bytes_written;
+  atomic_uint_least64_t bytes_combined;
+  atomic_uint_least64_t bytes_total;
+} stats;
+
+/**
+ * Hardware performance counters (--perf_counters), shared by every thread
+ * - every thread opens its own counter group on first use and adds the
+ *   counts between the start and end of a stage to the totals
+ * - counters the CPU, kernel or perf_event_paranoid refuse are left out
+ */
+typedef struct perf {
+  bool enabled;
+  bool kernel;
+  bool available[perf_counter_count];
+  atomic_uint_least64_t counts[perf_stage_count][perf_counter_count];
+  atomic_uint_least64_t bytes[perf_stage_count];
+  atomic_uint_least64_t threads;
+} perf;
+
+/**
+ * Counter values at the start of a stage (per thread)
+ */
+typedef struct perf_sample {
+  bool valid;
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t values[perf_counter_count];
+} perf_sample;
+
+/**
+ * One thread's counter group (ids maps the group read order to perf_*)
+ */
+typedef struct perf_group {
+  int fds[perf_counter_count];
+  unsigned int ids[perf_counter_count];
+  unsigned int count;
+} perf_group;
+
+/**
+ * Live progress reporter (--progress, --progress_fd)
+ * - the combine paths only add to the byte counters, a timer thread
+ *   samples them every progress_interval milliseconds
+ */
+typedef struct progress {
+  config* cfg;
+  uint64_t start;
+  uint64_t last;
+  uint64_t last_bytes;
+  double average;
+  bool terminal;
+  bool stop;
+  bool started;
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_t thread;
+} progress;
+
+/**
+ * Parallel combine (or verify) worker (one contiguous source range)
+ */
+typedef struct worker {
+  config* cfg;
+  obj* src;
+  bool verify;
+  size_t start;
+  size_t end;
+  bool started;
+  bool success;
+  pthread_t thread;
+} worker;
+
+/**
+ * Source chunk passed between pipeline stages
+ */
+typedef struct chunk {
+  char* buff;
+  size_t offset;
+  size_t length;
+  size_t done;
+  unsigned int state;
+} chunk;
+
+/**
+ * Reader / transform / writer pipeline shared state
+ * - free:  writer -> reader (empty buffers)
+ * - full:  reader -> transform (source data)
+ * - done:  transform -> writer (combined data)
+ */
+typedef struct pipeline {
+  config* cfg;
+  obj* src;
+  size_t count;
+  ring free;
+  ring full;
+  ring done;
+  atomic_bool failed;
+} pipeline;
+
+/**
+ * Key layers initialized by a pool of threads (prompts excepted)
+ */
+typedef struct keyset {
+  config* cfg;
+  atomic_size_t next;
+  atomic_size_t failed;
+} keyset;
+
+/**
+ * Batch of sources shared by a pool of workers
+ */
+typedef struct batch {
+  config* cfg;
+  atomic_size_t next;
+  atomic_size_t failed;
+} batch;
+
+/**
+ * Large source split into range tasks (recursive mode)
+ * - the last range to finish closes the source
+ */
+typedef struct split {
+  obj src;
+  atomic_size_t pending;
+  atomic_bool failed;
+} split;
+
+/**
+ * Unit of work of the recursive scheduler
+ * - task_directory: walk path
+ * - task_range:     combine start .. end of a split source
+ * - task_batch:     combine count small sources whole
+ */
+typedef struct task {
+  unsigned int type;
+  char* path;
+  split* part;
+  size_t start;
+  size_t end;
+  char* names[task_files];
+  size_t count;
+} task;
+
+/**
+ * Recursive scheduler shared state (one deque per walker)
+ */
+typedef struct tree {
+  config* cfg;
+  deque* queues;
+  fileset seen;
+  size_t count;
+  size_t span;
+  atomic_size_t pending;
+  atomic_size_t files;
+  atomic_size_t failed;
+  atomic_size_t bytes;
+} tree;
+
+/**
+ * Recursive scheduler worker thread
+ */
+typedef struct walker {
+  tree* job;
+  size_t indx;
+  cursor* cursors;
+  char* buff;
+  task* small;
+  bool started;
+  pthread_t thread;
+} walker;
+
 #endif
@@ -0,0 +1,38 @@
+#ifndef VKE_DEQUE_DEFINED
+#define VKE_DEQUE_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>    // size_t
+#include <pthread.h>   // pthread_mutex_t
+
+#include <alias.h>     // bool
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * Growable work-stealing deque of pointers
+ * - the owner pushes and pops at the bottom (newest first), other
+ *   threads steal from the top (oldest first)
+ */
+typedef struct deque {
+  void** slots;
+  size_t capacity;
+  size_t top;
+  size_t bottom;
+  pthread_mutex_t lock;
+} deque;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool deque_init(deque* dq, size_t capacity);
+void deque_free(deque* dq);
+
+bool deque_push(deque* dq, void* item);
+void* deque_pop(deque* dq);
+void* deque_steal(deque* dq);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef VKE_FILESET_DEFINED
+#define VKE_FILESET_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>    // size_t
+#include <pthread.h>   // pthread_mutex_t
+#include <sys/stat.h>  // stat, dev_t, ino_t
+
+#include <alias.h>     // bool
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * File identity of a set entry
+ */
+typedef struct file_id {
+  dev_t dev;
+  ino_t ino;
+  bool used;
+} file_id;
+
+/**
+ * Growable set of files by device and inode, shared between threads
+ * - tells a file apart from any other path (hard link, repeated name)
+ *   that leads to it
+ */
+typedef struct fileset {
+  file_id* slots;
+  size_t capacity;
+  size_t length;
+  pthread_mutex_t lock;
+} fileset;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool fileset_init(fileset* set, size_t capacity);
+void fileset_free(fileset* set);
+
+file_id* fileset_slot(file_id* slots, size_t capacity, dev_t dev, ino_t ino);
+bool fileset_add(fileset* set, const struct stat* info, bool* added);
+bool fileset_has(fileset* set, const struct stat* info);
+
+#endif
@@ -1,8 +1,16 @@
-
 //------------------------------------------------------------------------------
 // Dependencies
 
+#include <stddef.h> // size_t
+
+#include <sha3.h>   // sha3_ctx
+
 //------------------------------------------------------------------------------
 // Function prototypes
 
-char* get_hash(char* input);
+void hash_bytes(sha3_ctx* ctx, const char* input, size_t length,
+    unsigned char* digest);
+
+size_t derive_key(const char* text, size_t length, char* material);
+void derive_keys(const char** texts, const size_t* lengths, char** materials,
+    size_t* sizes, size_t count);
@@ -0,0 +1,53 @@
+#ifndef VKE_IO_DEFINED
+#define VKE_IO_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>    // size_t
+#include <sys/types.h> // ssize_t
+
+#include <alias.h>     // bool
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * Positional I/O handle on a raw file descriptor
+ * - opened files and block devices are read and written with pread / pwrite,
+ *   everything else (pipes, terminals, attached standard streams)
+ *   sequentially
+ * - a direct handle keeps a second descriptor without O_DIRECT (cached) for
+ *   unaligned transfers
+ */
+typedef struct vke_io {
+  int fd;
+  int cached;
+  bool owned;
+  bool positional;
+  bool direct;
+  size_t align;
+} vke_io;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool io_open(vke_io* io, const char* path, bool writable);
+bool io_temp(vke_io* io, char* path);
+void io_attach(vke_io* io, int fd);
+void io_close(vke_io* io);
+
+ssize_t io_read(vke_io* io, char* buff, size_t length, size_t offset);
+bool io_read_at(vke_io* io, char* buff, size_t length, size_t offset);
+bool io_write_at(vke_io* io, const char* buff, size_t length, size_t offset);
+
+bool io_direct(vke_io* io);
+bool io_aligned(vke_io* io, const char* buff, size_t length, size_t offset);
+
+bool io_size(vke_io* io, size_t* size);
+bool io_truncate(vke_io* io, size_t size);
+bool io_sync(vke_io* io);
+bool io_sync_parent(const char* path);
+bool io_pipe_size(vke_io* io, size_t size);
+
+#endif
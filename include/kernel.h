@@ -0,0 +1,51 @@
+#ifndef VKE_KERNEL_DEFINED
+#define VKE_KERNEL_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h> // size_t
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * XOR a key buffer into a data buffer (length bytes)
+ */
+typedef void (*xor_kernel)(char* buff, const char* key, size_t length);
+
+/**
+ * Sanitize length key bytes, the first of which sits at chunk index indx
+ * of a key chunk of key_read bytes
+ */
+typedef void (*sanitize_kernel)(char* buff, int indx, int length, int key_read);
+
+//------------------------------------------------------------------------------
+// Dispatched kernels (selected by init_kernels)
+
+extern xor_kernel xor_buffer;
+extern sanitize_kernel sanitize_bytes;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+void init_kernels(void);
+const char* xor_kernel_name(void);
+const char* sanitize_kernel_name(void);
+const char* sha3_kernel_name(void);
+
+void xor_buffer_generic(char* buff, const char* key, size_t length);
+void sanitize_bytes_generic(char* buff, int indx, int length, int key_read);
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define VKE_X86_KERNELS
+void xor_buffer_sse2(char* buff, const char* key, size_t length);
+void xor_buffer_avx2(char* buff, const char* key, size_t length);
+void xor_buffer_avx512(char* buff, const char* key, size_t length);
+
+void sanitize_bytes_sse41(char* buff, int indx, int length, int key_read);
+void sanitize_bytes_avx2(char* buff, int indx, int length, int key_read);
+void sanitize_bytes_avx512(char* buff, int indx, int length, int key_read);
+#endif
+
+#endif
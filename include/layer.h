@@ -9,5 +9,6 @@
 // Function prototypes
 
 bool add_layer(config* cfg, char* name, unsigned int indx);
+bool load_layers(config* cfg, const char* manifest, unsigned int* indx);
+void remove_layer(config* cfg, size_t indx);
 bool free_layers(config* cfg);
-void free_layer(layer* layr);
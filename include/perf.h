@@ -0,0 +1,56 @@
+#ifndef VKE_PERF_DEFINED
+#define VKE_PERF_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h> // size_t
+#include <stdio.h>  // FILE
+
+#include <alias.h>  // bool, false
+#include <data.h>   // config, perf, perf_sample
+
+//------------------------------------------------------------------------------
+// Shared state
+
+extern perf vke_perf;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool perf_enable(config* cfg);
+void perf_close(void);
+
+void perf_read(perf_sample* sample);
+void perf_add(unsigned int stage, perf_sample* begin, size_t bytes);
+
+void perf_json(FILE* out);
+void perf_report(config* cfg);
+
+//------------------------------------------------------------------------------
+// Stage scoping
+//
+// Inline so the hot paths only test a flag while counting is off.
+
+/**
+ * Read this thread's counters at the start of a stage
+ */
+static inline void perf_begin(perf_sample* sample) {
+  sample->valid = false;
+
+  if (vke_perf.enabled) {
+    perf_read(sample);
+  }
+}
+
+/**
+ * Add the counts since perf_begin() to a stage (perf_*)
+ */
+static inline void perf_stage(unsigned int stage, perf_sample* begin,
+    size_t bytes) {
+  if (begin->valid) {
+    perf_add(stage, begin, bytes);
+  }
+}
+
+#endif
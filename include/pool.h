@@ -0,0 +1,62 @@
+#ifndef VKE_POOL_DEFINED
+#define VKE_POOL_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>    // size_t
+#include <pthread.h>   // pthread_mutex_t
+
+#include <alias.h>     // bool
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * Block of an arena (the allocations follow the header)
+ */
+typedef struct arena_block {
+  struct arena_block* next;
+  size_t size;
+  size_t used;
+} arena_block;
+
+/**
+ * Bump allocator for state that lives as long as the run (layer names, key
+ * objects and key material), released all at once
+ * - keys are initialized by several threads, so allocations take a lock
+ */
+typedef struct arena {
+  arena_block* blocks;
+  size_t block;
+  pthread_mutex_t lock;
+} arena;
+
+/**
+ * Fixed set of I/O buffers of one size shared by every thread
+ * - buffers are created on first use and then only ever handed back and
+ *   forth, so memory stays at capacity buffers however many sources and
+ *   keys are processed
+ */
+typedef struct pool {
+  char** idle;
+  size_t count;
+  size_t created;
+  size_t capacity;
+  size_t size;
+  pthread_mutex_t lock;
+} pool;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+void arena_init(arena* mem, size_t block);
+void* arena_alloc(arena* mem, size_t size);
+void arena_free(arena* mem);
+
+bool pool_init(pool* buffers, size_t size, size_t capacity);
+char* pool_take(pool* buffers);
+void pool_give(pool* buffers, char* buff);
+void pool_free(pool* buffers);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef VKE_PROBE_DEFINED
+#define VKE_PROBE_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+//
+// USDT static probes (provider "vke") for perf, bpftrace and bcc.  The
+// sys/sdt.h macros only emit a nop and an ELF note, so there is nothing to
+// link against and nothing to pay until a tracer attaches.  Without the
+// header (or built with -DVKE_NO_PROBES) every probe compiles to nothing.
+//
+//   open(path, fd)                     close(fd)
+//   read__start(offset, length)        read__done(offset, length)
+//   write__start(offset, length)       write__done(offset, length)
+//   layer__start(layer, length)        layer__done(layer, length)
+//   sanitize(layer, length)            xor(layer, length)
+//   key__wrap(layer, length)           (v1 file key short read)
+//
+// e.g. bpftrace -e 'usdt:build/vke:vke:xor { @[arg0] = sum(arg1); }'
+
+#if !defined(VKE_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define VKE_PROBES
+#include <sys/sdt.h>  // DTRACE_PROBE1, DTRACE_PROBE2
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Probe points
+
+#ifdef VKE_PROBES
+#define probe1(name, a1)     DTRACE_PROBE1(vke, name, a1)
+#define probe2(name, a1, a2) DTRACE_PROBE2(vke, name, a1, a2)
+#else
+#define probe1(name, a1)
+#define probe2(name, a1, a2)
+#endif
+
+#endif
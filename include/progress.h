@@ -0,0 +1,19 @@
+#ifndef VKE_PROGRESS_DEFINED
+#define VKE_PROGRESS_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <alias.h>  // bool
+#include <data.h>   // config, progress
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool progress_start(progress* prog, config* cfg);
+void progress_stop(progress* prog);
+
+void* progress_timer(void* data);
+void progress_report(progress* prog, bool final);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef VKE_RING_DEFINED
+#define VKE_RING_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>    // size_t
+#include <stdatomic.h> // atomic_size_t
+
+#include <alias.h>     // bool
+
+//------------------------------------------------------------------------------
+// Data structures
+
+/**
+ * Single producer / single consumer lock-free ring of pointers
+ */
+typedef struct ring {
+  void** slots;
+  size_t capacity;
+  atomic_size_t head;
+  atomic_size_t tail;
+} ring;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool ring_init(ring* rng, size_t capacity);
+void ring_free(ring* rng);
+
+bool ring_push(ring* rng, void* item);
+void* ring_pop(ring* rng);
+
+void ring_wait(unsigned int* spins);
+
+#endif
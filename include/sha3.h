@@ -38,6 +38,21 @@ void rhash_sha3_512_init(sha3_ctx *ctx);
 void rhash_sha3_update(sha3_ctx *ctx, const unsigned char* msg, size_t size);
 void rhash_sha3_final(sha3_ctx *ctx, unsigned char* result);
 
+/* Keccak-f[1600] permutations, rhash_sha3_permutation() is the fastest
+ * one for the running CPU (selected by init_kernels) */
+extern void (*rhash_sha3_permutation)(uint64_t *state);
+extern void (*rhash_sha3_permutation_x4)(uint64_t *lanes);
+
+void rhash_sha3_permutation_reference(uint64_t *state);
+void rhash_sha3_permutation_unrolled(uint64_t *state);
+void rhash_sha3_permutation_x4_generic(uint64_t *lanes);
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define RHASH_SHA3_X86
+void rhash_sha3_permutation_bmi2(uint64_t *state);
+void rhash_sha3_permutation_x4_avx2(uint64_t *lanes);
+#endif
+
 #ifdef USE_KECCAK
 #define rhash_keccak_224_init rhash_sha3_224_init
 #define rhash_keccak_256_init rhash_sha3_256_init
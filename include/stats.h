@@ -0,0 +1,37 @@
+#ifndef VKE_STATS_DEFINED
+#define VKE_STATS_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint64_t
+
+#include <alias.h>  // bool
+#include <data.h>   // config, layer, stats
+
+//------------------------------------------------------------------------------
+// Shared state
+
+extern stats vke_stats;
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+void stats_enable(uint64_t start);
+void stats_count(void);
+bool stats_counting(void);
+uint64_t stats_clock(void);
+
+uint64_t stats_begin(void);
+uint64_t stats_since(uint64_t begin);
+void stats_phase(unsigned int phase, uint64_t begin);
+void stats_layer(layer* layr, unsigned int phase, uint64_t time);
+void stats_call(unsigned int call);
+void stats_bytes(unsigned int call, size_t bytes);
+void stats_combined(layer* layr, size_t bytes);
+void stats_total(size_t bytes);
+
+void stats_report(config* cfg, const char* version, int status);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef VKE_TREE_DEFINED
+#define VKE_TREE_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <sys/stat.h>  // stat
+
+#include <alias.h>     // bool
+#include <data.h>      // config, tree, walker, task, split
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool combine_tree(config* cfg);
+void* tree_worker(void* data);
+
+bool push_task(tree* job, walker* self, task* work);
+task* next_task(tree* job, walker* self);
+bool run_task(tree* job, walker* self, task* work);
+
+bool add_path(tree* job, walker* self, const char* path, bool follow);
+bool first_visit(tree* job, const char* path, struct stat* info, bool follow);
+bool add_split(tree* job, walker* self, const char* path);
+bool flush_batch(tree* job, walker* self);
+bool walk_directory(tree* job, walker* self, const char* path);
+
+bool combine_part(tree* job, walker* self, task* work);
+bool combine_small(tree* job, walker* self, task* work);
+void finish_split(tree* job, split* part, bool success);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef VKE_URING_DEFINED
+#define VKE_URING_DEFINED
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stddef.h>   // size_t
+#include <sys/uio.h>  // iovec
+
+#include <alias.h>    // bool
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define VKE_URING
+#include <linux/io_uring.h> // io_uring_sqe, io_uring_cqe, io_uring_params
+#endif
+#endif
+
+//------------------------------------------------------------------------------
+// Data structures
+
+#ifdef VKE_URING
+/**
+ * Minimal io_uring instance (raw syscalls, no liburing dependency)
+ */
+typedef struct uring {
+  int fd;
+  unsigned int entries;
+  unsigned int flags;
+  unsigned int pending;
+
+  void* sq_ptr;
+  size_t sq_length;
+  unsigned int* sq_head;
+  unsigned int* sq_tail;
+  unsigned int* sq_mask;
+  unsigned int* sq_flags;
+  unsigned int* sq_array;
+  struct io_uring_sqe* sqes;
+  size_t sqes_length;
+
+  void* cq_ptr;
+  size_t cq_length;
+  unsigned int* cq_head;
+  unsigned int* cq_tail;
+  unsigned int* cq_mask;
+  struct io_uring_cqe* cqes;
+} uring;
+#else
+typedef struct uring {
+  int fd;
+} uring;
+#endif
+
+//------------------------------------------------------------------------------
+// Function prototypes
+
+bool uring_init(uring* rng, unsigned int entries, bool sqpoll);
+void uring_exit(uring* rng);
+
+bool uring_register_buffers(uring* rng, struct iovec* buffers,
+    unsigned int count);
+bool uring_register_file(uring* rng, int fd);
+
+bool uring_read(uring* rng, unsigned int buffer, char* buff, size_t length,
+    size_t offset, unsigned long long data);
+bool uring_write(uring* rng, unsigned int buffer, const char* buff,
+    size_t length, size_t offset, unsigned long long data);
+
+bool uring_submit(uring* rng, unsigned int wait);
+bool uring_complete(uring* rng, unsigned long long* data, int* result);
+
+#endif
@@ -8,5 +8,8 @@
 //------------------------------------------------------------------------------
 // Function prototypes
 
-char* reverse_string(char* str);
-bool fill_key_buffer(obj* key);
+size_t fill_key_buffer(const obj* key, char* buff);
+void advance_key_buffer(char* buff, int key_read, size_t passes);
+
+char* alloc_buffer(size_t size);
+void free_buffer(char* buff, size_t size);
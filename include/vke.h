@@ -2,20 +2,55 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdio.h>  // FILE
-
 #include <alias.h>  // bool
-#include <data.h>   // config, obj
+#include <data.h>   // config, obj, layer, cursor, pipeline, chunk
+#include <io.h>     // vke_io
+#include <uring.h>  // uring
 
 //------------------------------------------------------------------------------
 // Function prototypes
 
 bool initialize(config* cfg, obj* info, char* name, int indx,
-    const char* access, bool force_file);
+    bool writable, bool force_file);
+size_t initialize_keys(config* cfg);
+void* key_worker(void* data);
+size_t initialize_group(config* cfg, layer** group, size_t count);
 
+bool check_source(config* cfg, obj* src);
 bool check(config* cfg, obj* src, obj* key);
-bool combine(config* cfg, obj* src, obj* key, FILE* output_stream);
-void sanitize_buffer(obj* key, int key_read);
+bool verify(config* cfg, obj* src);
+bool verify_range(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end);
+bool combine(config* cfg, obj* src, vke_io* output);
+bool combine_stream(config* cfg, obj* src, cursor* cursors, vke_io* output);
+bool combine_filter(config* cfg, vke_io* output);
+bool combine_mapped(config* cfg, obj* src, cursor* cursors, size_t start,
+    size_t end);
+bool combine_pipeline(config* cfg, obj* src, cursor* cursors);
+bool run_pipeline(pipeline* line, cursor* cursors);
+void* pipeline_reader(void* data);
+void* pipeline_writer(void* data);
+bool combine_uring(config* cfg, obj* src, cursor* cursors);
+bool run_uring(config* cfg, obj* src, cursor* cursors, uring* rng,
+    chunk* chunks, size_t depth, size_t end);
+bool combine_range(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end);
+bool combine_parallel(config* cfg, obj* src);
+bool run_workers(config* cfg, obj* src, bool verify);
+void* combine_worker(void* data);
+
+size_t cursor_buffers(config* cfg);
+cursor* open_cursors(config* cfg, bool private);
+void close_cursors(config* cfg, cursor* cursors);
+bool seek_cursor(cursor* cur, size_t position);
+bool place_cursor(cursor* cur, size_t src_size, size_t position);
+bool load_cursor(cursor* cur, size_t length);
+bool load_material(cursor* cur, size_t length);
+bool apply_cursor(cursor* cur, char* buff, size_t length);
+bool apply_cursors(config* cfg, cursor* cursors, char* buff, size_t length);
+
+bool open_output(config* cfg, obj* src, vke_io* target);
+bool close_output(config* cfg, vke_io* target, bool success);
 
 bool finalize(config* cfg, obj* src);
 bool finalize_source(config* cfg, obj* src);
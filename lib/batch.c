@@ -0,0 +1,299 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>     // FILE, fopen, fclose, getdelim, printf, stdin
+#include <stdlib.h>    // calloc, realloc, free
+#include <string.h>    // strlen, strcmp, strdup
+#include <pthread.h>   // pthread_create, pthread_join
+#include <stdatomic.h> // atomic_init, atomic_load, atomic_fetch_add
+#include <sys/stat.h>  // stat
+
+#include <alias.h>     // bool, true, false
+#include <data.h>      // config, obj, cursor, batch
+#include <fileset.h>   // fileset_init, fileset_add, fileset_free
+#include <io.h>        // io_open, io_size, io_direct, io_read_at, io_close
+#include <pool.h>      // pool_take, pool_give
+#include <stats.h>     // stats_clock, stats_counting, stats_total
+#include <vke.h>       // open_cursors, close_cursors, place_cursor,
+                       // apply_cursors, combine_range, combine_mapped
+#include <batch.h>
+
+//------------------------------------------------------------------------------
+// Source lists
+
+/**
+ * Add a source file to the batch
+ */
+bool add_source(config* cfg, const char* name) {
+  char** sources;
+  size_t capacity;
+
+  if (cfg->source_length == cfg->source_capacity) {
+    capacity = ((cfg->source_capacity > 0) ? cfg->source_capacity * 2 : 64);
+
+    if (!(sources = (char**) realloc(cfg->sources, capacity * sizeof(char*)))) {
+      printf("Cannot allocate memory for source %s\n", name);
+      return false;
+    }
+    cfg->sources         = sources;
+    cfg->source_capacity = capacity;
+  }
+  if (!(cfg->sources[cfg->source_length] = strdup(name))) {
+    printf("Cannot allocate memory for source %s\n", name);
+    return false;
+  }
+  cfg->source_length++;
+  return true;
+}
+
+/**
+ * Add every source of a list to the batch
+ * - a list file has one source per line
+ * - "-" reads a NUL delimited list from stdin (find -print0)
+ */
+bool load_sources(config* cfg, const char* list) {
+  FILE* input = stdin;
+  int delimiter = '\0';
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  bool success = true;
+
+  if (strcmp(list, "-") != 0) {
+    delimiter = '\n';
+
+    if (!(input = fopen(list, "r"))) {
+      printf("Unable to open %s\n", list);
+      return false;
+    }
+  }
+
+  while (success && (length = getdelim(&line, &capacity, delimiter, input)) > 0) {
+    if (line[length - 1] == delimiter) {
+      line[--length] = '\0';
+    }
+    if (length > 0 && line[length - 1] == '\r' && delimiter == '\n') {
+      line[--length] = '\0';
+    }
+    if (length > 0) {
+      success = add_source(cfg, line);
+    }
+  }
+
+  free(line);
+  if (input != stdin) {
+    fclose(input);
+  }
+  return success;
+}
+
+/**
+ * Release the batch source list
+ */
+void free_sources(config* cfg) {
+  size_t indx;
+
+  for (indx = 0; indx < cfg->source_length; indx++) {
+    free(cfg->sources[indx]);
+  }
+  free(cfg->sources);
+
+  cfg->sources         = NULL;
+  cfg->source_length   = 0;
+  cfg->source_capacity = 0;
+}
+
+//------------------------------------------------------------------------------
+// Batch processing
+
+/**
+ * Combine every batch source with the key set
+ * - keys are initialized once and shared, every worker keeps its own
+ *   cursors and buffer and takes the next source until the list is done
+ * - cfg->threads workers run at most
+ */
+bool combine_batch(config* cfg) {
+  batch job;
+  pthread_t* threads;
+  size_t count = cfg->threads;
+  size_t started;
+  size_t indx;
+
+  if (!unique_sources(cfg)) {
+    return false;
+  }
+  if (count > cfg->source_length) {
+    count = cfg->source_length;
+  }
+  if (count < 1) {
+    return true;
+  }
+  if (!(threads = (pthread_t*) calloc(count, sizeof(pthread_t)))) {
+    printf("Unable to create batch workers\n");
+    return false;
+  }
+
+  job.cfg = cfg;
+  atomic_init(&job.next, 0);
+  atomic_init(&job.failed, 0);
+
+  for (started = 0; started < count; started++) {
+    if (pthread_create(&threads[started], NULL, batch_worker, &job) != 0) {
+      printf("Unable to start batch worker %lu\n", started);
+      atomic_fetch_add(&job.failed, 1);
+      break;
+    }
+  }
+  for (indx = 0; indx < started; indx++) {
+    pthread_join(threads[indx], NULL);
+  }
+  free(threads);
+
+  if (!cfg->quiet) {
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
+    printf("Combined %lu of %lu sources (%dsec & %dms)\n", cfg->source_length - atomic_load(&job.failed), cfg->source_length, msec / 1000, msec % 1000);
+  }
+  return (atomic_load(&job.failed) == 0);
+}
+
+/**
+ * Drop the sources that name a file listed before (the same path or
+ * another link to it), a second pass would undo the first
+ * - progress gets the total of the remaining sources
+ * - sources that cannot be found are kept, the worker reports them
+ */
+bool unique_sources(config* cfg) {
+  fileset seen;
+  struct stat info;
+  size_t kept = 0;
+  size_t indx;
+  bool added;
+
+  if (!fileset_init(&seen, 1024)) {
+    printf("Unable to create batch workers\n");
+    return false;
+  }
+
+  for (indx = 0; indx < cfg->source_length; indx++) {
+    added = true;
+
+    if (stat(cfg->sources[indx], &info) == 0) {
+      if (!fileset_add(&seen, &info, &added)) {
+        printf("Unable to queue %s\n", cfg->sources[indx]);
+        fileset_free(&seen);
+        return false;
+      }
+      if (added && stats_counting()) {
+        stats_total(info.st_size);
+      }
+    }
+
+    if (added) {
+      cfg->sources[kept++] = cfg->sources[indx];
+    } else {
+      if (!cfg->quiet) {
+        printf("Skipping %s (listed before)\n", cfg->sources[indx]);
+      }
+      free(cfg->sources[indx]);
+    }
+  }
+  cfg->source_length = kept;
+
+  fileset_free(&seen);
+  return true;
+}
+
+/**
+ * Batch worker thread
+ */
+void* batch_worker(void* data) {
+  batch* job = (batch*) data;
+  config* cfg = job->cfg;
+  cursor* cursors;
+  char* buff;
+  obj src;
+  size_t next;
+  size_t indx;
+  bool success;
+
+  if (!(cursors = open_cursors(cfg, true))) {
+    atomic_fetch_add(&job->failed, 1);
+    return NULL;
+  }
+  if (!(buff = pool_take(&cfg->buffers))) {
+    printf("Unable to buffer batch sources\n");
+    atomic_fetch_add(&job->failed, 1);
+    close_cursors(cfg, cursors);
+    return NULL;
+  }
+
+  while ((next = atomic_fetch_add(&job->next, 1)) < cfg->source_length) {
+    src.name        = cfg->sources[next];
+    src.initialized = false;
+    src.is_file     = true;
+    src.out         = &src.io;
+    src.buff        = buff;
+    src.indx        = 0;
+
+    if (!cfg->quiet) {
+      int msec = (int)((stats_clock() - cfg->start) / 1000000);
+      printf("Combining source %s (%dsec & %dms)\n", src.name, msec / 1000, msec % 1000);
+    }
+
+    if (!io_open(&src.io, src.name, !cfg->dry_run)) {
+      printf("Unable to open %s\n", src.name);
+      atomic_fetch_add(&job->failed, 1);
+      continue;
+    }
+    success = io_size(&src.io, &src.size);
+    if (!success) {
+      printf("Unable to read from %s\n", src.name);
+    } else if (cfg->direct) {
+      io_direct(&src.io);
+    }
+    for (indx = 0; success && indx < cfg->key_length; indx++) {
+      success = place_cursor(&cursors[indx], src.size, 0);
+    }
+    if (!success || !combine_source(cfg, &src, cursors, buff, 0, src.size)) {
+      atomic_fetch_add(&job->failed, 1);
+    }
+    io_close(&src.io);
+  }
+
+  pool_give(&cfg->buffers, buff);
+  close_cursors(cfg, cursors);
+  return NULL;
+}
+
+/**
+ * Combine a range of a batch source in place
+ * - ranges that fit the buffer take one read and one write
+ * - dry runs only read and combine
+ */
+bool combine_source(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end) {
+  size_t length;
+
+  if (!cfg->dry_run) {
+    if (cfg->mmap && (end - start) > cfg->buffer_size) {
+      return combine_mapped(cfg, src, cursors, start, end);
+    }
+    return combine_range(cfg, src, cursors, buff, start, end);
+  }
+
+  while (start < end) {
+    length = end - start;
+    if (length > cfg->buffer_size) {
+      length = cfg->buffer_size;
+    }
+    if (!io_read_at(&src->io, buff, length, start)) {
+      printf("Unable to read from %s\n", src->name);
+      return false;
+    }
+    if (!apply_cursors(cfg, cursors, buff, length)) {
+      return false;
+    }
+    start += length;
+  }
+  return true;
+}
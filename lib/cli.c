@@ -3,35 +3,170 @@
 // Dependencies
 
 #include <stdio.h>   // printf
-#include <stdlib.h>  // free
+#include <stdlib.h>  // free, strtol, strtoull
 #include <string.h>  // strcmp
-#include <time.h>    // clock
+#include <limits.h>  // INT_MAX
+#include <stdint.h>  // SIZE_MAX, UINT32_MAX
+#include <errno.h>   // errno, ERANGE
+#include <fcntl.h>   // fcntl, F_GETFD
 
-#include <alias.h>   // true, false
+#include <alias.h>   // buff_size, page_align, arena_size, bool, true, false
 #include <data.h>    // config, layer
-#include <layer.h>   // add_layer, free_layer
+#include <pool.h>    // arena_init
+#include <layer.h>   // add_layer, load_layers, remove_layer
+#include <batch.h>   // add_source, load_sources
+#include <stats.h>   // stats_clock
 #include <cli.h>
 
 //------------------------------------------------------------------------------
 // Argument processing
 
+/**
+ * Parse a byte count with an optional K, M or G suffix (0 if invalid or
+ * too large for a size_t)
+ */
+size_t parse_size(const char* arg) {
+  char* end;
+  unsigned long long size;
+  unsigned int shift = 0;
+
+  errno = 0;
+  size  = strtoull(arg, &end, 10);
+
+  switch (*end) {
+    case 'G': case 'g': shift += 10;
+    /* fall through */
+    case 'M': case 'm': shift += 10;
+    /* fall through */
+    case 'K': case 'k': shift += 10;
+      end++;
+  }
+  if (*end != '\0' || arg[0] == '-' || errno == ERANGE
+      || size > (SIZE_MAX >> shift)) {
+    return 0;
+  }
+  return (size_t) size << shift;
+}
+
+/**
+ * Parse a count from 1 to high (0 if invalid or out of range)
+ */
+unsigned int parse_count(const char* arg, unsigned int high) {
+  char* end;
+  long count = strtol(arg, &end, 10);
+
+  if (*end != '\0' || arg[0] == '\0' || count < 1 || count > (long) high) {
+    return 0;
+  }
+  return (unsigned int) count;
+}
+
+/**
+ * Parse an open file descriptor number (-1 if invalid or closed)
+ */
+int parse_fd(const char* arg) {
+  char* end;
+  long fd = strtol(arg, &end, 10);
+
+  if (*end != '\0' || arg[0] == '\0' || fd < 0 || fd > INT_MAX
+      || fcntl((int) fd, F_GETFD) < 0) {
+    return -1;
+  }
+  return (int) fd;
+}
+
+/**
+ * Options that take the next argument as their value, process_args and
+ * stream_source both skip values through this table
+ */
+static const char* value_options[] = { "-t", "--threads", "-p", "--pipeline",
+    "-o", "--output", "--stats", "--progress_fd", "-k", "--keystream", "-b",
+    "--buffer_size", "-B", "--batch", "-r", "--recursive", "--keys_from" };
+
+/**
+ * Whether an option takes a value
+ */
+bool option_value(const char* arg) {
+  size_t indx;
+
+  for (indx = 0; indx < sizeof(value_options) / sizeof(*value_options); indx++) {
+    if (strcmp(arg, value_options[indx]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Whether the source is - (stdin filtered to stdout), known before any
+ * argument is processed
+ * - the first positional argument is the source unless --batch or
+ *   --recursive make every positional argument a key
+ */
+bool stream_source(int argc, char* argv[]) {
+  char* source = NULL;
+  int arg_indx;
+  char* arg;
+
+  for (arg_indx = 1; arg_indx < argc; arg_indx++) {
+    arg = argv[arg_indx];
+
+    if ((strcmp(arg, "-B") == 0) || (strcmp(arg, "--batch") == 0)
+        || (strcmp(arg, "-r") == 0) || (strcmp(arg, "--recursive") == 0)) {
+      return false;
+    } else if (option_value(arg)) {
+      arg_indx++;
+    } else if (source == NULL && (arg[0] != '-' || arg[1] == '\0')) {
+      source = arg;
+    }
+  }
+  return (source != NULL && strcmp(source, "-") == 0);
+}
+
 /**
  * Process CLI arguments
  */
 void process_args(config* cfg, int argc, char* argv[]) {
-  cfg->show_help      = false;
-  cfg->show_version   = false;
-  cfg->dry_run        = false;
-  cfg->quiet          = false;
-  cfg->hash_threshold = 200;
-  cfg->src_indx       = 1;
-  cfg->key_length     = 0;
-  cfg->keys           = NULL;
-  cfg->start          = clock();
-
-  int arg_indx     = 1;
-  int arg_layers   = 0;
-  int source_found = false;
+  cfg->show_help       = false;
+  cfg->show_version    = false;
+  cfg->dry_run         = false;
+  cfg->quiet           = false;
+  cfg->mmap            = false;
+  cfg->deep_check      = false;
+  cfg->hash_threshold  = 200;
+  cfg->keystream       = 1;
+  cfg->buffer_size     = buff_size;
+  cfg->threads         = 1;
+  cfg->pipeline        = 0;
+  cfg->uring           = false;
+  cfg->sqpoll          = false;
+  cfg->direct          = false;
+  cfg->output          = NULL;
+  cfg->output_path     = NULL;
+  cfg->output_temp     = NULL;
+  cfg->batch           = false;
+  cfg->recursive       = false;
+  cfg->stream          = false;
+  cfg->sources         = NULL;
+  cfg->source_length   = 0;
+  cfg->source_capacity = 0;
+  cfg->src_indx        = 1;
+  cfg->key_length      = 0;
+  cfg->key_capacity    = 0;
+  cfg->keys            = NULL;
+  cfg->stats           = false;
+  cfg->progress        = false;
+  cfg->progress_fd     = -1;
+  cfg->perf_counters   = false;
+  cfg->start           = stats_clock();
+
+  arena_init(&cfg->memory, arena_size);
+
+  int arg_indx            = 1;
+  int source_found        = false;
+  unsigned int arg_layers = 0;
+  size_t src_layer        = 0;
+  char* value;
   char* arg;
 
   while (arg_indx < argc) {
@@ -41,12 +176,18 @@ void process_args(config* cfg, int argc, char* argv[]) {
       cfg->quiet = true;
       break;
     }
-    arg_indx++;
+    arg_indx += ((option_value(arg)) ? 2 : 1);
   }
 
   arg_indx = 1;
   while (arg_indx < argc) {
-    arg = argv[arg_indx];
+    arg   = argv[arg_indx];
+    value = NULL;
+
+    // Options of the value table take the next argument (NULL if missing)
+    if (option_value(arg) && (arg_indx + 1) < argc) {
+      value = argv[++arg_indx];
+    }
 
     if ((strcmp(arg, "-h") == 0) || (strcmp(arg, "--help") == 0)) {
       cfg->show_help = true;
@@ -58,18 +199,120 @@ void process_args(config* cfg, int argc, char* argv[]) {
       break;
     } else if ((strcmp(arg, "-d") == 0) || (strcmp(arg, "--dry_run") == 0)) {
       cfg->dry_run = true;
+    } else if ((strcmp(arg, "-m") == 0) || (strcmp(arg, "--mmap") == 0)) {
+      cfg->mmap = true;
+    } else if ((strcmp(arg, "-t") == 0) || (strcmp(arg, "--threads") == 0)) {
+      if (!value || !(cfg->threads = parse_count(value, INT_MAX))) {
+        printf("Option %s requires a thread count\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+    } else if ((strcmp(arg, "-p") == 0) || (strcmp(arg, "--pipeline") == 0)) {
+      if (!value || !(cfg->pipeline = parse_count(value, INT_MAX))) {
+        printf("Option %s requires a chunk depth\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+    } else if ((strcmp(arg, "-u") == 0) || (strcmp(arg, "--uring") == 0)) {
+      cfg->uring = true;
+    } else if (strcmp(arg, "--sqpoll") == 0) {
+      cfg->uring  = true;
+      cfg->sqpoll = true;
+    } else if ((strcmp(arg, "-o") == 0) || (strcmp(arg, "--output") == 0)) {
+      if (!value) {
+        printf("Option %s requires a target file or device\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+      cfg->output = value;
+    } else if (strcmp(arg, "--direct") == 0) {
+      cfg->direct = true;
+    } else if (strcmp(arg, "--stats") == 0) {
+      if (!value || strcmp(value, "json") != 0) {
+        printf("Option %s requires a report format (json)\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+      cfg->stats = true;
+    } else if (strcmp(arg, "--progress") == 0) {
+      cfg->progress = true;
+    } else if (strcmp(arg, "--progress_fd") == 0) {
+      if (!value || (cfg->progress_fd = parse_fd(value)) < 0) {
+        printf("Option %s requires an open file descriptor\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+    } else if (strcmp(arg, "--perf_counters") == 0) {
+      cfg->perf_counters = true;
+    } else if ((strcmp(arg, "-k") == 0) || (strcmp(arg, "--keystream") == 0)) {
+      if (!value || !(cfg->keystream = parse_count(value, 2))) {
+        printf("Option %s requires a keystream version (1 or 2)\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+    } else if ((strcmp(arg, "-b") == 0) || (strcmp(arg, "--buffer_size") == 0)) {
+      if (!value || !(cfg->buffer_size = parse_size(value))) {
+        printf("Option %s requires a buffer size (bytes, or with a K, M or G suffix)\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+    } else if ((strcmp(arg, "-B") == 0) || (strcmp(arg, "--batch") == 0)) {
+      if (!value) {
+        printf("Option %s requires a source, @list file or - (NUL delimited stdin)\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+      cfg->batch = true;
+
+      if (value[0] == '@') {
+        cfg->show_help = !load_sources(cfg, value + 1);
+      } else if (strcmp(value, "-") == 0) {
+        cfg->show_help = !load_sources(cfg, value);
+      } else {
+        cfg->show_help = !add_source(cfg, value);
+      }
+      if (cfg->show_help) {
+        break;
+      }
+    } else if ((strcmp(arg, "-r") == 0) || (strcmp(arg, "--recursive") == 0)) {
+      if (!value) {
+        printf("Option %s requires a directory\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+      cfg->batch     = true;
+      cfg->recursive = true;
+
+      if (!add_source(cfg, value)) {
+        cfg->show_help = true;
+        break;
+      }
+    } else if (strcmp(arg, "--keys_from") == 0) {
+      if (!value) {
+        printf("Option %s requires a key manifest file\n", arg);
+        cfg->show_help = true;
+        break;
+      }
+      if (!load_layers(cfg, value, &arg_layers)) {
+        cfg->show_help = true;
+        break;
+      }
+    } else if ((strcmp(arg, "-c") == 0) || (strcmp(arg, "--deep_check") == 0)) {
+      cfg->deep_check = true;
     } else if ((strcmp(arg, "-q") == 0) || (strcmp(arg, "--quiet") == 0)) {
-    } else if (arg[0] == '-') {
+    } else if (arg[0] == '-' && arg[1] != '\0') {
       printf("Unrecognized option: %s\n", arg);
       cfg->show_help = true;
       break;
     } else {
-      add_layer(cfg, arg, arg_layers);
-      arg_layers++;
-
       if (!source_found) {
-        source_found = true;
+        source_found  = true;
         cfg->src_indx = arg_indx;
+        src_layer     = cfg->key_length;
+      }
+      if (!add_layer(cfg, arg, arg_layers++)) {
+        cfg->show_help = true;
+        break;
       }
     }
     arg_indx++;
@@ -78,12 +321,43 @@ void process_args(config* cfg, int argc, char* argv[]) {
   if (argc == 1) {
     cfg->show_help = true;
   }
-  if (arg_layers) {
-    cfg->key_length  = arg_layers - 1;
-
-    layer* src_layer = cfg->keys;
-    cfg->keys = cfg->keys->next;
-
-    free_layer(src_layer);
+  if (!cfg->batch && source_found) {
+    // Source "-" filters stdin to stdout
+    cfg->stream = (strcmp(argv[cfg->src_indx], "-") == 0);
+  }
+  if (cfg->output && (cfg->batch || cfg->mmap)) {
+    printf("Option --output is not supported with --batch, --recursive or --mmap\n");
+    cfg->show_help = true;
+  }
+  if (cfg->uring && cfg->buffer_size > UINT32_MAX) {
+    // io_uring submissions carry a 32 bit length
+    printf("Option --uring is not supported with a --buffer_size above 4G\n");
+    cfg->show_help = true;
+  }
+  if (cfg->direct && cfg->mmap) {
+    printf("Option --direct is not supported with --mmap\n");
+    cfg->show_help = true;
+  }
+  if (cfg->direct && (cfg->buffer_size % page_align) != 0) {
+    // Direct transfers need block aligned lengths (rounded down only where
+    // rounding up would wrap)
+    if (cfg->buffer_size > SIZE_MAX - page_align) {
+      cfg->buffer_size -= cfg->buffer_size % page_align;
+    } else {
+      cfg->buffer_size += page_align - (cfg->buffer_size % page_align);
+    }
+  }
+  if (cfg->stream && cfg->deep_check) {
+    printf("Option --deep_check is not supported with a - (stdin) source\n");
+    cfg->show_help = true;
+  }
+  if (cfg->batch && cfg->deep_check) {
+    printf("Option --deep_check is not supported with --batch or --recursive\n");
+    cfg->show_help = true;
+  }
+  if (!cfg->batch && source_found) {
+    // The first positional argument is the source, with --batch every
+    // positional argument is a key
+    remove_layer(cfg, src_layer);
   }
 }
@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdlib.h>    // calloc, free
+#include <pthread.h>   // pthread_mutex_init, pthread_mutex_lock,
+                       // pthread_mutex_unlock, pthread_mutex_destroy
+
+#include <alias.h>     // bool, true, false
+#include <deque.h>
+
+//------------------------------------------------------------------------------
+// Initialization
+
+/**
+ * Create an empty deque with room for capacity items (it grows as needed)
+ */
+bool deque_init(deque* dq, size_t capacity) {
+  dq->capacity = capacity;
+  dq->top      = 0;
+  dq->bottom   = 0;
+
+  if (!(dq->slots = (void**) calloc(dq->capacity, sizeof(void*)))) {
+    return false;
+  }
+  pthread_mutex_init(&dq->lock, NULL);
+  return true;
+}
+
+void deque_free(deque* dq) {
+  if (dq->slots != NULL) {
+    free(dq->slots);
+    dq->slots = NULL;
+    pthread_mutex_destroy(&dq->lock);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Deque operations
+//
+// top and bottom only ever grow, slots are indexed modulo the capacity.  The
+// lock is per deque, so it is only contended while another thread steals.
+
+/**
+ * Add an item at the bottom (owner side), false if it cannot grow
+ */
+bool deque_push(deque* dq, void* item) {
+  void** slots;
+  size_t indx;
+
+  pthread_mutex_lock(&dq->lock);
+
+  if ((dq->bottom - dq->top) == dq->capacity) {
+    if (!(slots = (void**) calloc(dq->capacity * 2, sizeof(void*)))) {
+      pthread_mutex_unlock(&dq->lock);
+      return false;
+    }
+    for (indx = dq->top; indx < dq->bottom; indx++) {
+      slots[indx % (dq->capacity * 2)] = dq->slots[indx % dq->capacity];
+    }
+    free(dq->slots);
+    dq->slots     = slots;
+    dq->capacity *= 2;
+  }
+  dq->slots[dq->bottom % dq->capacity] = item;
+  dq->bottom++;
+
+  pthread_mutex_unlock(&dq->lock);
+  return true;
+}
+
+/**
+ * Remove the newest item (owner side), NULL if the deque is empty
+ */
+void* deque_pop(deque* dq) {
+  void* item = NULL;
+
+  pthread_mutex_lock(&dq->lock);
+
+  if (dq->bottom > dq->top) {
+    dq->bottom--;
+    item = dq->slots[dq->bottom % dq->capacity];
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return item;
+}
+
+/**
+ * Remove the oldest item (thief side), NULL if the deque is empty
+ */
+void* deque_steal(deque* dq) {
+  void* item = NULL;
+
+  pthread_mutex_lock(&dq->lock);
+
+  if (dq->bottom > dq->top) {
+    item = dq->slots[dq->top % dq->capacity];
+    dq->top++;
+  }
+  pthread_mutex_unlock(&dq->lock);
+  return item;
+}
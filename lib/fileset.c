@@ -0,0 +1,109 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdlib.h>    // calloc, free
+#include <pthread.h>   // pthread_mutex_init, pthread_mutex_lock,
+                       // pthread_mutex_unlock, pthread_mutex_destroy
+#include <sys/stat.h>  // stat
+
+#include <alias.h>     // bool, true, false
+#include <fileset.h>
+
+//------------------------------------------------------------------------------
+// Initialization
+
+/**
+ * Create an empty set with room for capacity files (a power of two, it
+ * grows as needed)
+ */
+bool fileset_init(fileset* set, size_t capacity) {
+  set->capacity = capacity;
+  set->length   = 0;
+
+  if (!(set->slots = (file_id*) calloc(set->capacity, sizeof(file_id)))) {
+    return false;
+  }
+  pthread_mutex_init(&set->lock, NULL);
+  return true;
+}
+
+void fileset_free(fileset* set) {
+  if (set->slots != NULL) {
+    free(set->slots);
+    set->slots = NULL;
+    pthread_mutex_destroy(&set->lock);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Set operations
+//
+// Open addressing with linear probing, the table is kept at most half full
+// so probe runs stay short.
+
+/**
+ * Slot of a file, either its entry or the free slot it would take
+ */
+file_id* fileset_slot(file_id* slots, size_t capacity, dev_t dev, ino_t ino) {
+  size_t indx = ((size_t) ino * 0x9E3779B97F4A7C15ull
+      ^ (size_t) dev * 0xC2B2AE3D27D4EB4Full) & (capacity - 1);
+
+  while (slots[indx].used
+      && (slots[indx].dev != dev || slots[indx].ino != ino)) {
+    indx = (indx + 1) & (capacity - 1);
+  }
+  return &slots[indx];
+}
+
+/**
+ * Add the file of a stat result, added tells whether it was new (false if
+ * the set cannot grow)
+ */
+bool fileset_add(fileset* set, const struct stat* info, bool* added) {
+  file_id* slots;
+  file_id* slot;
+  size_t indx;
+
+  pthread_mutex_lock(&set->lock);
+
+  if ((set->length + 1) * 2 > set->capacity) {
+    if (!(slots = (file_id*) calloc(set->capacity * 2, sizeof(file_id)))) {
+      pthread_mutex_unlock(&set->lock);
+      return false;
+    }
+    for (indx = 0; indx < set->capacity; indx++) {
+      if (set->slots[indx].used) {
+        *fileset_slot(slots, set->capacity * 2, set->slots[indx].dev,
+            set->slots[indx].ino) = set->slots[indx];
+      }
+    }
+    free(set->slots);
+    set->slots     = slots;
+    set->capacity *= 2;
+  }
+
+  slot   = fileset_slot(set->slots, set->capacity, info->st_dev, info->st_ino);
+  *added = !slot->used;
+
+  if (*added) {
+    slot->dev  = info->st_dev;
+    slot->ino  = info->st_ino;
+    slot->used = true;
+    set->length++;
+  }
+  pthread_mutex_unlock(&set->lock);
+  return true;
+}
+
+/**
+ * Whether the file of a stat result is in the set
+ */
+bool fileset_has(fileset* set, const struct stat* info) {
+  bool found;
+
+  pthread_mutex_lock(&set->lock);
+  found = fileset_slot(set->slots, set->capacity, info->st_dev,
+      info->st_ino)->used;
+  pthread_mutex_unlock(&set->lock);
+  return found;
+}
@@ -1,23 +1,184 @@
-
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdlib.h>  // malloc, free
-#include <string.h>  // strlen
+#include <string.h>      // memset, memcpy
 
-#include <sha3.h>    // sha_ctx, rhash_sha3_512_init, rhash_sha3_update,
-                     // rhash_sha3_final
+#include <alias.h>       // hash_rate, hash_part, bool
+#include <data.h>        // sponge
+#include <byte_order.h>  // le2me_64
+#include <sha3.h>        // sha3_ctx, sha3_max_permutation_size,
+                         // rhash_sha3_512_init, rhash_sha3_update,
+                         // rhash_sha3_final, rhash_sha3_permutation,
+                         // rhash_sha3_permutation_x4
 #include <hash.h>
 
 //------------------------------------------------------------------------------
-// Initialization
-
-char* get_hash(char* input) {
-  sha3_ctx* ctx = malloc(sizeof(sha3_ctx));
+// Hashing
 
+/**
+ * SHA3-512 of length bytes into digest (sha3_512_hash_size bytes), the
+ * context is the caller's (usually on the stack)
+ */
+void hash_bytes(sha3_ctx* ctx, const char* input, size_t length,
+    unsigned char* digest) {
   rhash_sha3_512_init(ctx);
-  rhash_sha3_update(ctx, (const unsigned char*)input, strlen(input));
-  rhash_sha3_final(ctx, NULL);
+  rhash_sha3_update(ctx, (const unsigned char*) input, length);
+  rhash_sha3_final(ctx, digest);
+}
+
+//------------------------------------------------------------------------------
+// Key derivation
+//
+// A text key becomes hash(text) || hash(reversed text).  Keys derived by
+// earlier versions took each hash as a C string over its sha3_ctx, so the
+// material is the state up to its first NUL, running on into the final
+// message block (still in the context) when the state has none.  That is
+// kept byte for byte, with the final block rebuilt instead of read back.
+
+/**
+ * Message block of a sponge, padded if it is the last one
+ */
+static void sponge_block(sponge* sp, size_t block, unsigned char* bytes) {
+  size_t start = block * hash_rate;
+  size_t indx;
+
+  memset(bytes, 0, hash_rate);
+
+  for (indx = 0; indx < hash_rate && start + indx < sp->length; indx++) {
+    bytes[indx] = sp->text[(sp->reverse)
+        ? sp->length - 1 - (start + indx) : start + indx];
+  }
+  if (block == sp->blocks - 1) {
+    bytes[sp->length - start] |= 0x06;
+    bytes[hash_rate - 1]      |= 0x80;
+  }
+}
+
+/**
+ * Key material of a finished sponge (at most hash_part bytes)
+ */
+static size_t sponge_material(const uint64_t* state, const unsigned char* last,
+    char* material) {
+  const unsigned char* bytes = (const unsigned char*) state;
+  size_t size = 0;
+  size_t indx;
+
+  while (size < sizeof(uint64_t) * sha3_max_permutation_size && bytes[size]) {
+    material[size] = bytes[size];
+    size++;
+  }
+  if (size == sizeof(uint64_t) * sha3_max_permutation_size) {
+    for (indx = 0; indx < hash_rate && last[indx]; indx++) {
+      material[size++] = last[indx];
+    }
+  }
+  return size;
+}
+
+/**
+ * Run up to four sponges side by side, lane n of the interleaved state is
+ * sponge n
+ * - without a vector permutation the sponges are permuted one by one
+ */
+static void absorb_sponges(sponge* group, size_t count) {
+  uint64_t lanes[4 * sha3_max_permutation_size];
+  uint64_t state[sha3_max_permutation_size];
+  uint64_t words[hash_rate / 8];
+  unsigned char last[4][hash_rate];
+  bool batched = (count > 1
+      && rhash_sha3_permutation_x4 != rhash_sha3_permutation_x4_generic);
+  size_t blocks = 0;
+  size_t block;
+  size_t lane;
+  size_t n;
+
+  memset(lanes, 0, sizeof(lanes));
+
+  for (n = 0; n < count; n++) {
+    blocks = ((group[n].blocks > blocks) ? group[n].blocks : blocks);
+  }
+
+  for (block = 0; block < blocks; block++) {
+    for (n = 0; n < count; n++) {
+      if (block < group[n].blocks) {
+        sponge_block(&group[n], block, last[n]);
+        memcpy(words, last[n], hash_rate);
+
+        for (lane = 0; lane < hash_rate / 8; lane++) {
+          lanes[4 * lane + n] ^= le2me_64(words[lane]);
+        }
+      }
+    }
+
+    if (batched) {
+      rhash_sha3_permutation_x4(lanes);
+    }
+    for (n = 0; n < count; n++) {
+      if (block >= group[n].blocks) {
+        continue;
+      }
+      for (lane = 0; lane < sha3_max_permutation_size; lane++) {
+        state[lane] = lanes[4 * lane + n];
+      }
+      if (!batched) {
+        rhash_sha3_permutation(state);
+
+        for (lane = 0; lane < sha3_max_permutation_size; lane++) {
+          lanes[4 * lane + n] = state[lane];
+        }
+      }
+      if (block == group[n].blocks - 1) {
+        group[n].size = sponge_material(state, last[n], group[n].material);
+      }
+    }
+  }
+}
+
+/**
+ * Derive the key material of many text keys, two keys (four sponges) at a
+ * time
+ * - materials need key_material bytes each and may be the texts themselves
+ */
+void derive_keys(const char** texts, const size_t* lengths, char** materials,
+    size_t* sizes, size_t count) {
+  char parts[4][hash_part];
+  sponge group[4];
+  size_t key;
+  size_t pair;
+  size_t n;
+
+  for (key = 0; key < count; key += 2) {
+    pair = ((count - key > 1) ? 2 : 1);
+
+    for (n = 0; n < 2 * pair; n++) {
+      group[n].text     = texts[key + (n / 2)];
+      group[n].length   = lengths[key + (n / 2)];
+      group[n].reverse  = (n & 1);
+      group[n].blocks   = (group[n].length / hash_rate) + 1;
+      group[n].material = parts[n];
+      group[n].size     = 0;
+    }
+    absorb_sponges(group, 2 * pair);
+
+    for (n = 0; n < pair; n++) {
+      char* material = materials[key + n];
+
+      memcpy(material, parts[2 * n], group[2 * n].size);
+      memcpy(material + group[2 * n].size, parts[(2 * n) + 1],
+          group[(2 * n) + 1].size);
+
+      sizes[key + n] = group[2 * n].size + group[(2 * n) + 1].size;
+      material[sizes[key + n]] = '\0';
+    }
+  }
+}
+
+/**
+ * Derive the key material of one text key (see derive_keys)
+ */
+size_t derive_key(const char* text, size_t length, char* material) {
+  size_t size;
 
-  return (char*)ctx->hash;
+  derive_keys(&text, &length, &material, &size, 1);
+  return size;
 }
@@ -0,0 +1,349 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#define _GNU_SOURCE    // F_SETPIPE_SZ, O_DIRECT
+
+#include <stdio.h>     // snprintf
+#include <stdlib.h>    // mkstemp
+#include <string.h>    // strrchr, memcpy
+#include <errno.h>     // errno, EINTR
+#include <fcntl.h>     // open, fcntl, O_RDONLY, O_RDWR, O_CLOEXEC, O_DIRECT,
+                       // O_ACCMODE, F_GETFL, F_SETPIPE_SZ
+#include <unistd.h>    // pread, pwrite, read, write, close, ftruncate,
+                       // fsync, fdatasync
+#include <sys/stat.h>  // fstat, S_ISREG, S_ISBLK, S_ISFIFO
+#include <sys/ioctl.h> // ioctl
+#include <linux/fs.h>  // BLKGETSIZE64, BLKSSZGET
+
+#include <alias.h>     // page_align, phase_*, call_*, bool, true, false
+#include <perf.h>      // perf_begin, perf_stage
+#include <probe.h>     // probe1, probe2
+#include <stats.h>     // stats_begin, stats_phase, stats_call, stats_bytes
+#include <io.h>
+
+//------------------------------------------------------------------------------
+// Handles
+
+/**
+ * Open a file for positional reads (and writes)
+ */
+bool io_open(vke_io* io, const char* path, bool writable) {
+  struct stat info;
+  int fd;
+
+  do {
+    fd = open(path, ((writable) ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    stats_call(call_other);
+  } while (fd < 0 && errno == EINTR);
+
+  if (fd < 0) {
+    io->fd     = -1;
+    io->owned  = false;
+    io->direct = false;
+    return false;
+  }
+  io->fd         = fd;
+  io->cached     = -1;
+  io->owned      = true;
+  io->direct     = false;
+  io->align      = 1;
+  probe2(open, path, fd);
+
+  stats_call(call_other);
+  io->positional = (fstat(fd, &info) == 0
+      && (S_ISREG(info.st_mode) || S_ISBLK(info.st_mode)));
+  return true;
+}
+
+/**
+ * Create and open a new temporary file (path is a mkstemp template and
+ * receives the name)
+ */
+bool io_temp(vke_io* io, char* path) {
+  int fd;
+
+  stats_call(call_other);
+
+  if ((fd = mkstemp(path)) < 0) {
+    io->fd     = -1;
+    io->owned  = false;
+    io->direct = false;
+    return false;
+  }
+  io->fd         = fd;
+  io->cached     = -1;
+  io->owned      = true;
+  io->direct     = false;
+  io->align      = 1;
+  io->positional = true;
+  return true;
+}
+
+/**
+ * Wrap a standard stream that is owned elsewhere (e.g. stdin, stderr)
+ * - always sequential, the stream may be shared or opened for appending
+ */
+void io_attach(vke_io* io, int fd) {
+  io->fd         = fd;
+  io->cached     = -1;
+  io->owned      = false;
+  io->direct     = false;
+  io->align      = 1;
+  io->positional = false;
+}
+
+/**
+ * Close an owned handle
+ */
+void io_close(vke_io* io) {
+  if (io->owned && io->fd >= 0) {
+    stats_call(call_other);
+    probe1(close, io->fd);
+    close(io->fd);
+
+    if (io->direct && io->cached >= 0) {
+      close(io->cached);
+    }
+  }
+  io->fd     = -1;
+  io->cached = -1;
+  io->direct = false;
+}
+
+//------------------------------------------------------------------------------
+// Direct I/O
+//
+// O_DIRECT transfers bypass the page cache but need the buffer, length and
+// offset aligned to the logical block size.  Anything unaligned (the tail of
+// a source, mostly) goes through a second, cached descriptor of the same
+// file.  O_DIRECT belongs to the open file description, so flipping it for
+// one transfer would change it under every thread sharing the handle.
+
+/**
+ * Switch a positional handle to direct I/O (false if the file system or
+ * device does not support it)
+ * - the file is opened once more with O_DIRECT, the descriptor the handle
+ *   had so far is kept for unaligned transfers
+ */
+bool io_direct(vke_io* io) {
+  struct stat info;
+  char path[32];
+  int flags;
+  int block;
+  int fd;
+
+  stats_call(call_other);
+
+  if (!io->positional || io->direct || fstat(io->fd, &info) != 0
+      || (flags = fcntl(io->fd, F_GETFL)) < 0) {
+    return false;
+  }
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", io->fd);
+
+  do {
+    fd = open(path, (flags & O_ACCMODE) | O_CLOEXEC | O_DIRECT);
+    stats_call(call_other);
+  } while (fd < 0 && errno == EINTR);
+
+  if (fd < 0) {
+    return false;
+  }
+  io->cached = io->fd;
+  io->fd     = fd;
+  io->direct = true;
+  io->align  = page_align;
+
+  if (S_ISBLK(info.st_mode) && ioctl(io->fd, BLKSSZGET, &block) == 0
+      && block > 0) {
+    io->align = block;
+  }
+  return true;
+}
+
+/**
+ * Whether a transfer can go through direct I/O as is
+ */
+bool io_aligned(vke_io* io, const char* buff, size_t length, size_t offset) {
+  return (((size_t) buff % io->align) == 0 && (length % io->align) == 0
+      && (offset % io->align) == 0);
+}
+
+//------------------------------------------------------------------------------
+// Reads and writes
+
+/**
+ * Read up to length bytes at an offset
+ * - short only at the end of the file, -1 on errors
+ */
+ssize_t io_read(vke_io* io, char* buff, size_t length, size_t offset) {
+  uint64_t begin = stats_begin();
+  size_t done = 0;
+  ssize_t count = 0;
+  int fd = (io->direct && !io_aligned(io, buff, length, offset))
+      ? io->cached : io->fd;
+  perf_sample sample;
+
+  perf_begin(&sample);
+
+  while (done < length) {
+    if (io->positional) {
+      count = pread(fd, buff + done, length - done, offset + done);
+    } else {
+      count = read(fd, buff + done, length - done);
+    }
+    stats_call(call_read);
+
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 1) {
+      break;
+    }
+    done += count;
+  }
+  stats_bytes(call_read, done);
+  stats_phase(phase_read, begin);
+  perf_stage(perf_io, &sample, done);
+  return ((count < 0) ? -1 : (ssize_t) done);
+}
+
+/**
+ * Read exactly length bytes at an offset
+ */
+bool io_read_at(vke_io* io, char* buff, size_t length, size_t offset) {
+  return (io_read(io, buff, length, offset) == (ssize_t) length);
+}
+
+/**
+ * Write exactly length bytes at an offset (retrying short writes)
+ */
+bool io_write_at(vke_io* io, const char* buff, size_t length, size_t offset) {
+  uint64_t begin = stats_begin();
+  size_t total = length;
+  ssize_t count = 0;
+  int fd = (io->direct && !io_aligned(io, buff, length, offset))
+      ? io->cached : io->fd;
+  perf_sample sample;
+
+  perf_begin(&sample);
+
+  while (length > 0) {
+    if (io->positional) {
+      count = pwrite(fd, buff, length, offset);
+    } else {
+      count = write(fd, buff, length);
+    }
+    stats_call(call_write);
+
+    if (count < 0 && errno == EINTR) {
+      continue;
+    }
+    if (count < 1) {
+      break;
+    }
+    stats_bytes(call_write, count);
+    buff   += count;
+    offset += count;
+    length -= count;
+  }
+  stats_phase(phase_write, begin);
+  perf_stage(perf_io, &sample, total - length);
+  return (length == 0);
+}
+
+//------------------------------------------------------------------------------
+// File information
+
+/**
+ * Size of the file behind a handle
+ * - block devices report no size through fstat, it is asked for instead
+ */
+bool io_size(vke_io* io, size_t* size) {
+  struct stat info;
+  unsigned long long bytes;
+
+  stats_call(call_other);
+
+  if (fstat(io->fd, &info) != 0) {
+    return false;
+  }
+  if (S_ISBLK(info.st_mode)) {
+    if (ioctl(io->fd, BLKGETSIZE64, &bytes) != 0) {
+      return false;
+    }
+    *size = bytes;
+  } else {
+    *size = info.st_size;
+  }
+  return true;
+}
+
+/**
+ * Set the size of a file
+ */
+bool io_truncate(vke_io* io, size_t size) {
+  stats_call(call_other);
+  return (ftruncate(io->fd, size) == 0);
+}
+
+/**
+ * Flush written data to stable storage
+ */
+bool io_sync(vke_io* io) {
+  uint64_t begin = stats_begin();
+  bool success   = (fdatasync(io->fd) == 0);
+
+  stats_call(call_sync);
+  stats_phase(phase_write, begin);
+  return success;
+}
+
+/**
+ * Flush the directory entry of a path (after creating or renaming it)
+ */
+bool io_sync_parent(const char* path) {
+  const char* slash = strrchr(path, '/');
+  char dir[4096];
+  bool success;
+  int fd;
+
+  if (slash == NULL) {
+    dir[0] = '.';
+    dir[1] = '\0';
+  } else if (slash == path) {
+    dir[0] = '/';
+    dir[1] = '\0';
+  } else if ((size_t)(slash - path) < sizeof(dir)) {
+    memcpy(dir, path, slash - path);
+    dir[slash - path] = '\0';
+  } else {
+    return false;
+  }
+
+  stats_call(call_other);
+
+  if ((fd = open(dir, O_RDONLY | O_CLOEXEC)) < 0) {
+    return false;
+  }
+  success = (fsync(fd) == 0);
+  close(fd);
+
+  stats_call(call_sync);
+  stats_call(call_other);
+  return success;
+}
+
+/**
+ * Grow the kernel buffer of a pipe (false if the handle is no pipe or the
+ * size was refused)
+ */
+bool io_pipe_size(vke_io* io, size_t size) {
+  struct stat info;
+
+  stats_call(call_other);
+
+  if (fstat(io->fd, &info) != 0 || !S_ISFIFO(info.st_mode)) {
+    return false;
+  }
+  return (fcntl(io->fd, F_SETPIPE_SZ, (int) size) >= 0);
+}
@@ -0,0 +1,344 @@
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdint.h>  // uint64_t
+#include <string.h>  // memcpy
+
+#include <sha3.h>    // rhash_sha3_permutation, rhash_sha3_permutation_x4,
+                     // rhash_sha3_permutation_bmi2, rhash_sha3_permutation_x4_avx2
+#include <kernel.h>
+
+#ifdef VKE_X86_KERNELS
+#include <immintrin.h> // SSE2, AVX2 and AVX-512 intrinsics
+#endif
+
+//------------------------------------------------------------------------------
+// Dispatch
+
+xor_kernel xor_buffer          = xor_buffer_generic;
+sanitize_kernel sanitize_bytes = sanitize_bytes_generic;
+
+static const char* xor_name      = "generic";
+static const char* sanitize_name = "generic";
+static const char* sha3_name     = "unrolled";
+
+/**
+ * Select the fastest kernels the running CPU supports (cpuid)
+ */
+void init_kernels(void) {
+#ifdef VKE_X86_KERNELS
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx512f")) {
+    xor_buffer = xor_buffer_avx512;
+    xor_name   = "avx512";
+  } else if (__builtin_cpu_supports("avx2")) {
+    xor_buffer = xor_buffer_avx2;
+    xor_name   = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    xor_buffer = xor_buffer_sse2;
+    xor_name   = "sse2";
+  }
+
+  if (__builtin_cpu_supports("avx512f")) {
+    sanitize_bytes = sanitize_bytes_avx512;
+    sanitize_name  = "avx512";
+  } else if (__builtin_cpu_supports("avx2")) {
+    sanitize_bytes = sanitize_bytes_avx2;
+    sanitize_name  = "avx2";
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    sanitize_bytes = sanitize_bytes_sse41;
+    sanitize_name  = "sse4.1";
+  }
+
+#ifdef RHASH_SHA3_X86
+  // ANDN and RORX beat lane complementing, AVX2 runs four states at once
+  if (__builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2")) {
+    rhash_sha3_permutation = rhash_sha3_permutation_bmi2;
+    sha3_name              = "bmi2";
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    rhash_sha3_permutation_x4 = rhash_sha3_permutation_x4_avx2;
+  }
+#endif
+#endif
+}
+
+const char* xor_kernel_name(void) {
+  return xor_name;
+}
+
+const char* sanitize_kernel_name(void) {
+  return sanitize_name;
+}
+
+const char* sha3_kernel_name(void) {
+  return sha3_name;
+}
+
+//------------------------------------------------------------------------------
+// XOR kernels
+
+/**
+ * Portable XOR, one 64 bit word at a time
+ */
+void xor_buffer_generic(char* buff, const char* key, size_t length) {
+  size_t indx = 0;
+  uint64_t data;
+  uint64_t mask;
+
+  for (; (indx + 8) <= length; indx += 8) {
+    memcpy(&data, buff + indx, 8);
+    memcpy(&mask, key + indx, 8);
+    data ^= mask;
+    memcpy(buff + indx, &data, 8);
+  }
+  for (; indx < length; indx++) {
+    buff[indx] ^= key[indx];
+  }
+}
+
+#ifdef VKE_X86_KERNELS
+
+__attribute__((target("sse2")))
+void xor_buffer_sse2(char* buff, const char* key, size_t length) {
+  size_t indx = 0;
+
+  for (; (indx + 64) <= length; indx += 64) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(buff + indx));
+    __m128i b = _mm_loadu_si128((const __m128i*)(buff + indx + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*)(buff + indx + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*)(buff + indx + 48));
+
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(key + indx)));
+    b = _mm_xor_si128(b, _mm_loadu_si128((const __m128i*)(key + indx + 16)));
+    c = _mm_xor_si128(c, _mm_loadu_si128((const __m128i*)(key + indx + 32)));
+    d = _mm_xor_si128(d, _mm_loadu_si128((const __m128i*)(key + indx + 48)));
+
+    _mm_storeu_si128((__m128i*)(buff + indx), a);
+    _mm_storeu_si128((__m128i*)(buff + indx + 16), b);
+    _mm_storeu_si128((__m128i*)(buff + indx + 32), c);
+    _mm_storeu_si128((__m128i*)(buff + indx + 48), d);
+  }
+  for (; (indx + 16) <= length; indx += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(buff + indx));
+    a = _mm_xor_si128(a, _mm_loadu_si128((const __m128i*)(key + indx)));
+    _mm_storeu_si128((__m128i*)(buff + indx), a);
+  }
+  xor_buffer_generic(buff + indx, key + indx, length - indx);
+}
+
+__attribute__((target("avx2")))
+void xor_buffer_avx2(char* buff, const char* key, size_t length) {
+  size_t indx = 0;
+
+  for (; (indx + 128) <= length; indx += 128) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(buff + indx));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(buff + indx + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i*)(buff + indx + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i*)(buff + indx + 96));
+
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(key + indx)));
+    b = _mm256_xor_si256(b, _mm256_loadu_si256((const __m256i*)(key + indx + 32)));
+    c = _mm256_xor_si256(c, _mm256_loadu_si256((const __m256i*)(key + indx + 64)));
+    d = _mm256_xor_si256(d, _mm256_loadu_si256((const __m256i*)(key + indx + 96)));
+
+    _mm256_storeu_si256((__m256i*)(buff + indx), a);
+    _mm256_storeu_si256((__m256i*)(buff + indx + 32), b);
+    _mm256_storeu_si256((__m256i*)(buff + indx + 64), c);
+    _mm256_storeu_si256((__m256i*)(buff + indx + 96), d);
+  }
+  for (; (indx + 32) <= length; indx += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(buff + indx));
+    a = _mm256_xor_si256(a, _mm256_loadu_si256((const __m256i*)(key + indx)));
+    _mm256_storeu_si256((__m256i*)(buff + indx), a);
+  }
+  xor_buffer_generic(buff + indx, key + indx, length - indx);
+}
+
+__attribute__((target("avx512f")))
+void xor_buffer_avx512(char* buff, const char* key, size_t length) {
+  size_t indx = 0;
+
+  for (; (indx + 256) <= length; indx += 256) {
+    __m512i a = _mm512_loadu_si512((const void*)(buff + indx));
+    __m512i b = _mm512_loadu_si512((const void*)(buff + indx + 64));
+    __m512i c = _mm512_loadu_si512((const void*)(buff + indx + 128));
+    __m512i d = _mm512_loadu_si512((const void*)(buff + indx + 192));
+
+    a = _mm512_xor_si512(a, _mm512_loadu_si512((const void*)(key + indx)));
+    b = _mm512_xor_si512(b, _mm512_loadu_si512((const void*)(key + indx + 64)));
+    c = _mm512_xor_si512(c, _mm512_loadu_si512((const void*)(key + indx + 128)));
+    d = _mm512_xor_si512(d, _mm512_loadu_si512((const void*)(key + indx + 192)));
+
+    _mm512_storeu_si512((void*)(buff + indx), a);
+    _mm512_storeu_si512((void*)(buff + indx + 64), b);
+    _mm512_storeu_si512((void*)(buff + indx + 128), c);
+    _mm512_storeu_si512((void*)(buff + indx + 192), d);
+  }
+  xor_buffer_avx2(buff + indx, key + indx, length - indx);
+}
+
+#endif
+
+//------------------------------------------------------------------------------
+// Sanitize kernels
+//
+// Every kernel must match the reference bit for bit:
+//
+//   b = ((b + index) * key_read) % 255;  if (b == 0) b = 1;
+//
+// with a signed char b, wrapping 32 bit int arithmetic and a C (truncating)
+// remainder.  The vector kernels compute |v| % 255 by folding the bytes of
+// |v| (256 = 1 mod 255), restore the sign of v and turn zeros into ones
+// without branching.
+
+/**
+ * Portable reference implementation
+ */
+void sanitize_bytes_generic(char* buff, int indx, int length, int key_read) {
+  int index;
+  int value;
+
+  for (index = 0; index < length; index++) {
+    value = (int)((unsigned int)(buff[index] + indx + index) * (unsigned int)key_read) % 255;
+    buff[index] = value + (value == 0);
+  }
+}
+
+#ifdef VKE_X86_KERNELS
+
+__attribute__((target("sse4.1")))
+static inline __m128i sanitize_lanes_sse41(__m128i bytes, __m128i index, __m128i key_read) {
+  const __m128i low  = _mm_set1_epi32(0xff);
+  const __m128i high = _mm_set1_epi32(254);
+  __m128i value = _mm_mullo_epi32(_mm_add_epi32(_mm_cvtepi8_epi32(bytes), index), key_read);
+  __m128i fold  = _mm_abs_epi32(value);
+
+  fold = _mm_add_epi32(
+      _mm_add_epi32(_mm_and_si128(fold, low), _mm_and_si128(_mm_srli_epi32(fold, 8), low)),
+      _mm_add_epi32(_mm_and_si128(_mm_srli_epi32(fold, 16), low), _mm_srli_epi32(fold, 24)));
+  fold = _mm_add_epi32(_mm_and_si128(fold, low), _mm_srli_epi32(fold, 8));
+  fold = _mm_sub_epi32(fold, _mm_and_si128(_mm_cmpgt_epi32(fold, high), _mm_set1_epi32(255)));
+  fold = _mm_sign_epi32(fold, value);
+  fold = _mm_sub_epi32(fold, _mm_cmpeq_epi32(fold, _mm_setzero_si128()));
+
+  return _mm_and_si128(fold, low);
+}
+
+__attribute__((target("sse4.1")))
+void sanitize_bytes_sse41(char* buff, int indx, int length, int key_read) {
+  const __m128i multiplier = _mm_set1_epi32(key_read);
+  const __m128i step       = _mm_set1_epi32(4);
+  __m128i index = _mm_setr_epi32(indx, indx + 1, indx + 2, indx + 3);
+  int offset = 0;
+
+  for (; (offset + 16) <= length; offset += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(buff + offset));
+    __m128i a, b, c, d;
+
+    a = sanitize_lanes_sse41(bytes, index, multiplier);
+    index = _mm_add_epi32(index, step);
+    b = sanitize_lanes_sse41(_mm_srli_si128(bytes, 4), index, multiplier);
+    index = _mm_add_epi32(index, step);
+    c = sanitize_lanes_sse41(_mm_srli_si128(bytes, 8), index, multiplier);
+    index = _mm_add_epi32(index, step);
+    d = sanitize_lanes_sse41(_mm_srli_si128(bytes, 12), index, multiplier);
+    index = _mm_add_epi32(index, step);
+
+    _mm_storeu_si128((__m128i*)(buff + offset),
+        _mm_packus_epi16(_mm_packus_epi32(a, b), _mm_packus_epi32(c, d)));
+  }
+  sanitize_bytes_generic(buff + offset, indx + offset, length - offset, key_read);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sanitize_lanes_avx2(__m128i bytes, __m256i index, __m256i key_read) {
+  const __m256i low  = _mm256_set1_epi32(0xff);
+  const __m256i high = _mm256_set1_epi32(254);
+  __m256i value = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_cvtepi8_epi32(bytes), index), key_read);
+  __m256i fold  = _mm256_abs_epi32(value);
+
+  fold = _mm256_add_epi32(
+      _mm256_add_epi32(_mm256_and_si256(fold, low), _mm256_and_si256(_mm256_srli_epi32(fold, 8), low)),
+      _mm256_add_epi32(_mm256_and_si256(_mm256_srli_epi32(fold, 16), low), _mm256_srli_epi32(fold, 24)));
+  fold = _mm256_add_epi32(_mm256_and_si256(fold, low), _mm256_srli_epi32(fold, 8));
+  fold = _mm256_sub_epi32(fold, _mm256_and_si256(_mm256_cmpgt_epi32(fold, high), _mm256_set1_epi32(255)));
+  fold = _mm256_sign_epi32(fold, value);
+  fold = _mm256_sub_epi32(fold, _mm256_cmpeq_epi32(fold, _mm256_setzero_si256()));
+
+  return _mm256_and_si256(fold, low);
+}
+
+__attribute__((target("avx2")))
+void sanitize_bytes_avx2(char* buff, int indx, int length, int key_read) {
+  const __m256i multiplier = _mm256_set1_epi32(key_read);
+  const __m256i step       = _mm256_set1_epi32(8);
+  const __m256i order      = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i index = _mm256_add_epi32(_mm256_set1_epi32(indx), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+  int offset = 0;
+
+  for (; (offset + 32) <= length; offset += 32) {
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)(buff + offset));
+    __m128i low   = _mm256_castsi256_si128(bytes);
+    __m128i high  = _mm256_extracti128_si256(bytes, 1);
+    __m256i a, b, c, d;
+
+    a = sanitize_lanes_avx2(low, index, multiplier);
+    index = _mm256_add_epi32(index, step);
+    b = sanitize_lanes_avx2(_mm_srli_si128(low, 8), index, multiplier);
+    index = _mm256_add_epi32(index, step);
+    c = sanitize_lanes_avx2(high, index, multiplier);
+    index = _mm256_add_epi32(index, step);
+    d = sanitize_lanes_avx2(_mm_srli_si128(high, 8), index, multiplier);
+    index = _mm256_add_epi32(index, step);
+
+    _mm256_storeu_si256((__m256i*)(buff + offset), _mm256_permutevar8x32_epi32(
+        _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d)), order));
+  }
+  sanitize_bytes_sse41(buff + offset, indx + offset, length - offset, key_read);
+}
+
+__attribute__((target("avx512f")))
+static inline __m128i sanitize_lanes_avx512(__m128i bytes, __m512i index, __m512i key_read) {
+  const __m512i low  = _mm512_set1_epi32(0xff);
+  const __m512i zero = _mm512_setzero_si512();
+  __m512i value = _mm512_mullo_epi32(_mm512_add_epi32(_mm512_cvtepi8_epi32(bytes), index), key_read);
+  __m512i fold  = _mm512_abs_epi32(value);
+
+  fold = _mm512_add_epi32(
+      _mm512_add_epi32(_mm512_and_si512(fold, low), _mm512_and_si512(_mm512_srli_epi32(fold, 8), low)),
+      _mm512_add_epi32(_mm512_and_si512(_mm512_srli_epi32(fold, 16), low), _mm512_srli_epi32(fold, 24)));
+  fold = _mm512_add_epi32(_mm512_and_si512(fold, low), _mm512_srli_epi32(fold, 8));
+  fold = _mm512_mask_sub_epi32(fold, _mm512_cmpgt_epi32_mask(fold, _mm512_set1_epi32(254)), fold, _mm512_set1_epi32(255));
+  fold = _mm512_mask_sub_epi32(fold, _mm512_cmplt_epi32_mask(value, zero), zero, fold);
+  fold = _mm512_mask_mov_epi32(fold, _mm512_cmpeq_epi32_mask(fold, zero), _mm512_set1_epi32(1));
+
+  return _mm512_cvtepi32_epi8(fold);
+}
+
+__attribute__((target("avx512f")))
+void sanitize_bytes_avx512(char* buff, int indx, int length, int key_read) {
+  const __m512i multiplier = _mm512_set1_epi32(key_read);
+  const __m512i step       = _mm512_set1_epi32(16);
+  __m512i index = _mm512_add_epi32(_mm512_set1_epi32(indx),
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+  int offset = 0;
+
+  for (; (offset + 32) <= length; offset += 32) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(buff + offset));
+    __m128i b = _mm_loadu_si128((const __m128i*)(buff + offset + 16));
+
+    a = sanitize_lanes_avx512(a, index, multiplier);
+    index = _mm512_add_epi32(index, step);
+    b = sanitize_lanes_avx512(b, index, multiplier);
+    index = _mm512_add_epi32(index, step);
+
+    _mm_storeu_si128((__m128i*)(buff + offset), a);
+    _mm_storeu_si128((__m128i*)(buff + offset + 16), b);
+  }
+  sanitize_bytes_avx2(buff + offset, indx + offset, length - offset, key_read);
+}
+
+#endif
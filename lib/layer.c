@@ -2,13 +2,15 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdio.h>   // printf
-#include <stdlib.h>  // malloc, free
-#include <string.h>  // strlen, strcpy
-#include <time.h>    // CLOCKS_PER_SEC, clock_t, clock
+#include <stdio.h>     // FILE, fopen, fclose, getline, printf
+#include <stdlib.h>    // realloc, free
+#include <string.h>    // strlen, memcpy, memmove
+#include <stdatomic.h> // atomic_init
 
-#include <alias.h>   // bool, true, false
-#include <data.h>    // config, layer
+#include <alias.h>     // phase_count, bool, true, false
+#include <data.h>      // config, layer
+#include <pool.h>      // arena_alloc
+#include <stats.h>     // stats_clock
 #include <layer.h>
 
 //------------------------------------------------------------------------------
@@ -16,69 +18,108 @@
 
 /**
  * Add a new encryption/decryption layer to the configuration arguments
+ * - layers are one array that doubles as it fills, the names belong to
+ *   the arena
  */
 bool add_layer(config* cfg, char* name, unsigned int indx) {
-  layer* operation = malloc(sizeof(layer));
+  layer* operation;
+  layer* layers;
+  size_t capacity;
+  unsigned int phase;
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
     printf("Adding new layer %s (%dsec & %dms)\n", name, msec / 1000, msec % 1000);
   }
 
-  if (operation == NULL) {
+  if (cfg->key_length == cfg->key_capacity) {
+    capacity = ((cfg->key_capacity > 0) ? cfg->key_capacity * 2 : 64);
+
+    if (!(layers = (layer*) realloc(cfg->keys, capacity * sizeof(layer)))) {
+      printf("Cannot allocate memory for layer %s\n", name);
+      return false;
+    }
+    cfg->keys         = layers;
+    cfg->key_capacity = capacity;
+  }
+  operation = &cfg->keys[cfg->key_length];
+
+  if (!(operation->name = (char*) arena_alloc(&cfg->memory, strlen(name) + 1))) {
     printf("Cannot allocate memory for layer %s\n", name);
     return false;
   }
-
-  operation->name = (char*)malloc((strlen(name) + 1) * sizeof(char));
-  strcpy(operation->name, name);
+  memcpy(operation->name, name, strlen(name) + 1);
 
   operation->indx = indx;
   operation->key  = NULL;
-  operation->next = NULL;
-
-  if (cfg->keys == NULL) {
-    cfg->keys = operation;
-  } else {
-    // Add one operation onto the end
-    layer* temp = cfg->keys;
-    while (temp->next != NULL) {
-      temp = temp->next;
-    }
-    temp->next = operation;
+
+  for (phase = 0; phase < phase_count; phase++) {
+    atomic_init(&operation->times[phase], 0);
   }
+  atomic_init(&operation->bytes, 0);
+
+  cfg->key_length++;
   return true;
 }
 
 /**
- * Free all created encyption/decryption layers from memory
+ * Add a layer for every line of a key manifest (key files, key text or
+ * prompt, as on the command line)
+ * - empty lines are skipped, indx is the index of the first layer and is
+ *   advanced past the last
  */
-bool free_layers(config* cfg) {
+bool load_layers(config* cfg, const char* manifest, unsigned int* indx) {
+  FILE* input;
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  bool success = true;
 
-  if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
-    printf("Cleaning up all layers (%dsec & %dms)\n", msec / 1000, msec % 1000);
+  if (!(input = fopen(manifest, "r"))) {
+    printf("Unable to open %s\n", manifest);
+    return false;
   }
 
-  if (cfg->keys != NULL) {
-    layer* layr = cfg->keys;
-    while (layr != NULL) {
-      layer temp;
-      memcpy(&temp, layr, sizeof(layer));
-
-      free_layer(layr);
-      layr = temp.next;
+  while (success && (length = getline(&line, &capacity, input)) > 0) {
+    if (line[length - 1] == '\n') {
+      line[--length] = '\0';
+    }
+    if (length > 0 && line[length - 1] == '\r') {
+      line[--length] = '\0';
+    }
+    if (length > 0) {
+      success = add_layer(cfg, line, (*indx)++);
     }
   }
-  return true;
+
+  free(line);
+  fclose(input);
+  return success;
+}
+
+/**
+ * Drop a layer (the source of a single source run), the layers after it
+ * move up
+ */
+void remove_layer(config* cfg, size_t indx) {
+  memmove(&cfg->keys[indx], &cfg->keys[indx + 1],
+      (cfg->key_length - indx - 1) * sizeof(layer));
+  cfg->key_length--;
 }
 
 /**
- * Free a registered layer
+ * Free all created encyption/decryption layers from memory
  */
-void free_layer(layer* layr) {
-  if (layr != NULL) {
-    free(layr->name);
-    free(layr);
+bool free_layers(config* cfg) {
+
+  if (!cfg->quiet) {
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
+    printf("Cleaning up all layers (%dsec & %dms)\n", msec / 1000, msec % 1000);
   }
+
+  free(cfg->keys);
+  cfg->keys         = NULL;
+  cfg->key_length   = 0;
+  cfg->key_capacity = 0;
+  return true;
 }
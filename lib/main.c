@@ -8,15 +8,26 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdio.h>  // FILE, stderr, printf
-#include <stdlib.h> // malloc, free
-#include <time.h>   // CLOCKS_PER_SEC, clock_t, clock
+#include <stdio.h>    // stdin, stdout, stderr, printf
+#include <unistd.h>   // dup, dup2, STDOUT_FILENO, STDERR_FILENO
 
-#include <alias.h>  // true, false
-#include <data.h>   // config, obj, layer
-#include <cli.h>    // process_args
-#include <vke.h>    // initialize, check, combine, finalize
-#include <layer.h>  // free_layers
+#include <alias.h>    // queue_depth, true, false
+#include <data.h>     // config, obj, layer
+#include <io.h>       // vke_io, io_open, io_attach, io_close
+#include <cli.h>      // stream_source, process_args
+#include <vke.h>      // initialize, initialize_keys, check_source, check,
+                      // verify, combine, combine_filter, open_output,
+                      // close_output, finalize
+#include <layer.h>    // free_layers
+#include <kernel.h>   // init_kernels
+#include <batch.h>    // combine_batch, free_sources
+#include <tree.h>     // combine_tree
+#include <stats.h>    // stats_enable, stats_clock, stats_begin, stats_since,
+                      // stats_phase, stats_layer, stats_total, stats_report
+#include <progress.h> // progress_start, progress_stop
+#include <perf.h>     // perf_enable, perf_begin, perf_stage, perf_report,
+                      // perf_close
+#include <pool.h>     // arena_free, pool_init, pool_free
 
 //------------------------------------------------------------------------------
 // Version information
@@ -29,24 +40,55 @@ char* vke_version = "1.3";
 int main(int argc, char* argv[]) {
   int errors = 0;
   int status = 0;
+  int data_fd = -1;
+  uint64_t begin;
+  perf_sample sample;
+  size_t depth;
+  size_t indx;
 
   config cfg;
   obj src;
 
-  src.data = NULL;
-  src.buff = NULL;
+  src.initialized = false;
+  src.io.fd       = -1;
+  src.size        = 0;
+  src.buff        = NULL;
 
-  FILE* output_stream = NULL;
+  vke_io sink;
+  vke_io target;
+  progress prog;
+  vke_io* output = NULL;
 
   char *help[] =
       {
           "                                                                                   ",
           " Usage: vke  <source.file>  <key.file | key text | 'prompt'> ...                   ",
+          "        vke  -B <source.file | @list.file | ->  <key ...> ...                      ",
+          "        vke  -r <directory>  <key ...> ...                                         ",
+          "        vke  -  <key ...> ...  (stdin to stdout, text keys need -k 2)              ",
           "                                                                                   ",
           "          -h | --help     Display this help information                            ",
           "          -v | --version  Display VKE version information                          ",
           "          -d | --dry_run  Test encryption / decryption without editing source file ",
           "          -q | --quiet    Suppress all output except errors and warnings           ",
+          "          -m | --mmap     Combine in place through memory mapped source windows    ",
+          "          -c | --deep_check  Verify every key over the whole source before writing ",
+          "          -t | --threads <n>  Combine the source in n parallel ranges              ",
+          "          -p | --pipeline <n>  Overlap reads, XOR and writes with n chunks         ",
+          "          -u | --uring    Queue source reads and writes through io_uring           ",
+          "               --sqpoll   Use io_uring with a kernel submission thread             ",
+          "               --direct   Bypass the page cache with O_DIRECT source I/O           ",
+          "          -o | --output <path>  Write to a file or device, the source is only read ",
+          "               --stats json  Write phase timings and I/O counts to stderr at exit  ",
+          "               --progress  Report bytes done, MB/s and ETA on stderr every second  ",
+          "               --progress_fd <n>  Also write JSON progress lines to descriptor n   ",
+          "               --perf_counters  Report cycles/byte and IPC per stage at exit       ",
+          "               --keys_from <file>  Add one key (file, text, prompt) per line       ",
+          "          -b | --buffer_size <n>  Source I/O buffer size (K, M or G suffix)        ",
+          "          -k | --keystream <v>    Keystream version (1 = default, 2 = seekable)    ",
+          "          -B | --batch <src | @list | ->  Add batch sources (- = NUL list, stdin)  ",
+          "                          all other arguments are then keys, -t sets workers       ",
+          "          -r | --recursive <dir>  Combine every file below dir (also with -B, -t)  ",
           "                                                                                   ",
           "-----------------------------------------------------------------------------------",
           "                                                                                   ",
@@ -68,12 +110,40 @@ int main(int argc, char* argv[]) {
           "     Author: Adrian Webb (adrian.webb@coraltech.net)                               ",
           "                                                                                   " };
 
+  init_kernels();
+
+  // stdout carries the data of a - (stdin) source, status messages move
+  // over to stderr before the first one is printed
+  if (stream_source(argc, argv)) {
+    data_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+  }
   process_args(&cfg, argc, argv);
 
-  if (cfg.key_length
-      && (!initialize(&cfg, &src, argv[cfg.src_indx], 0, "rb+", true))) {
+  // One source buffer plus the pipeline chunks in flight or one buffer per
+  // worker, whichever is more (no mode needs both)
+  depth = ((cfg.pipeline > 0) ? cfg.pipeline : queue_depth);
+
+  if (!pool_init(&cfg.buffers, cfg.buffer_size,
+      1 + ((cfg.threads > depth) ? cfg.threads : depth))) {
+    printf("Unable to create source buffers\n");
+    return 2;
+  }
+
+  if (cfg.stats) {
+    stats_enable(cfg.start);
+  }
+  if (cfg.perf_counters && !cfg.show_help && !cfg.show_version) {
+    perf_enable(&cfg);
+  }
+  begin = stats_begin();
+
+  if (cfg.key_length && !cfg.batch && !cfg.stream
+      && (!initialize(&cfg, &src, argv[cfg.src_indx], 0,
+          (cfg.output == NULL), true))) {
     cfg.show_help = true;
   }
+  stats_phase(phase_init, begin);
 
   if (cfg.show_help) {
     size_t i;
@@ -85,40 +155,81 @@ int main(int argc, char* argv[]) {
   } else if (cfg.show_version) {
     printf("VKE version: %s\n", vke_version);
   } else {
-    if (cfg.dry_run && cfg.quiet) {
-      output_stream = fopen("/dev/null", "w");
+    if (cfg.output && !cfg.dry_run) {
+      if (open_output(&cfg, &src, &target)) {
+        output = &target;
+      } else {
+        errors++;
+      }
+    } else if (cfg.stream) {
+      io_attach(&sink, data_fd);
+      output = &sink;
+    } else if (cfg.dry_run && cfg.quiet) {
+      if (io_open(&sink, "/dev/null", true)) {
+        output = &sink;
+      } else {
+        printf("Unable to open /dev/null\n");
+        errors++;
+      }
+    } else if (cfg.dry_run) {
+      io_attach(&sink, fileno(stderr));
+      output = &sink;
     } else {
-      output_stream = ((cfg.dry_run) ? stderr : src.data);
+      output = &src.io;
     }
 
-    if (cfg.keys != NULL) {
+    if (cfg.key_length > 0) {
       // First pass - Verify to minimize the chances of screwing up our file.
-      layer* temp = cfg.keys;
-      do {
-        temp->key = (struct obj*) malloc(sizeof(struct obj));
-
-        if (temp->key == NULL) {
-          printf("Cannot create memory for key %s", temp->name);
-          errors++;
-        } else if (initialize(&cfg, temp->key, temp->name, temp->indx, "rb",
-            false)) {
+      begin = stats_begin();
+      if (!check_source(&cfg, &src)) {
+        errors++;
+      }
+      stats_phase(phase_check, begin);
+
+      errors += initialize_keys(&cfg);
+
+      for (indx = 0; indx < cfg.key_length; indx++) {
+        layer* temp = &cfg.keys[indx];
+
+        if (temp->key->initialized) {
+          begin = stats_begin();
           if (!check(&cfg, &src, temp->key)) {
             errors++;
           }
-        } else {
-          errors++;
+          stats_layer(temp, phase_check, stats_since(begin));
         }
-      } while ((temp = temp->next) != NULL);
+      }
+
+      begin = stats_begin();
+      perf_begin(&sample);
+      if (errors == 0 && cfg.deep_check && !verify(&cfg, &src)) {
+        errors++;
+      }
+      stats_phase(phase_verify, begin);
+      perf_stage(perf_verify, &sample,
+          ((cfg.deep_check) ? src.size * cfg.key_length : 0));
 
       // Second pass - Combine source and keys to toggle encryption / decryption.
-      if (errors == 0) {
-        temp = cfg.keys;
-        do {
-          if (!combine(&cfg, &src, temp->key, output_stream)) {
-            errors++;
-          }
-        } while ((temp = temp->next) != NULL);
+      prog.started = false;
+
+      if (errors == 0 && (cfg.progress || cfg.progress_fd >= 0)
+          && progress_start(&prog, &cfg) && !cfg.batch && !cfg.stream) {
+        stats_total(src.size);
+      }
+      begin = stats_begin();
+      if (errors == 0 && cfg.recursive && !combine_tree(&cfg)) {
+        errors++;
+      } else if (errors == 0 && cfg.batch && !cfg.recursive
+          && !combine_batch(&cfg)) {
+        errors++;
+      } else if (errors == 0 && cfg.stream && !combine_filter(&cfg, output)) {
+        errors++;
+      } else if (errors == 0 && !cfg.batch && !cfg.stream
+          && !combine(&cfg, &src, output)) {
+        errors++;
       }
+      stats_phase(phase_combine, begin);
+      progress_stop(&prog);
     }
 
     if (cfg.dry_run && !cfg.quiet) {
@@ -126,23 +237,39 @@ int main(int argc, char* argv[]) {
     }
   }
 
-  if (src.data && !finalize(&cfg, &src)) {
+  begin = stats_begin();
+  if (output == &target && !close_output(&cfg, &target, errors == 0)) {
+    errors++;
+  }
+  stats_phase(phase_close, begin);
+
+  // Reported while the key objects are still around
+  if (!cfg.show_help && !cfg.show_version) {
+    stats_report(&cfg, vke_version, (errors > 0) ? (errors + 1) : 0);
+    perf_report(&cfg);
+  }
+  perf_close();
+  if ((src.io.fd >= 0 || ((cfg.batch || cfg.stream) && cfg.key_length > 0))
+      && !finalize(&cfg, &src)) {
     errors++;
   }
+  free_sources(&cfg);
   if (!free_layers(&cfg)) {
     errors++;
   }
+  pool_free(&cfg.buffers);
+  arena_free(&cfg.memory);
   if (errors > 0) {
     status = (errors + 1);
   }
 
   if (errors == 0 && !cfg.quiet) {
-    int msec = ((clock_t)(clock() - cfg.start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg.start) / 1000000);
     printf("Done in %dsec & %dms\n\n", msec / 1000, msec % 1000);
   }
 
-  if (cfg.dry_run && cfg.quiet && output_stream != NULL) {
-    fclose(output_stream);
+  if (output == &sink) {
+    io_close(&sink);
   }
   fclose(stdin);
   fclose(stdout);
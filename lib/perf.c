@@ -0,0 +1,391 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>            // printf, fprintf, stderr
+#include <stdlib.h>           // calloc, free
+#include <string.h>           // memset, strerror
+#include <errno.h>            // errno
+#include <unistd.h>           // syscall, read, close
+#include <pthread.h>          // pthread_key_create, pthread_getspecific,
+                              // pthread_setspecific
+#include <stdatomic.h>        // atomic_init, atomic_load, atomic_fetch_add_explicit
+#include <sys/syscall.h>      // SYS_perf_event_open
+#include <linux/perf_event.h> // perf_event_attr, PERF_TYPE_*, PERF_COUNT_*,
+                              // PERF_FORMAT_*, PERF_FLAG_FD_CLOEXEC
+
+#include <alias.h>            // perf_*, bool, true, false
+#include <data.h>             // config, perf, perf_sample, perf_group
+#include <perf.h>
+
+//------------------------------------------------------------------------------
+// Shared state
+
+perf vke_perf;
+
+static pthread_key_t perf_key;
+
+static const char* stage_names[perf_stage_count] = {
+  "key_init", "hashing", "verify", "sanitize", "xor", "io"
+};
+
+static const char* counter_names[perf_counter_count] = {
+  "cycles", "instructions", "llc_misses", "branch_misses", "dtlb_misses",
+  "task_clock_ns"
+};
+
+//------------------------------------------------------------------------------
+// Counter groups
+
+/**
+ * Event attributes for a counter (perf_*)
+ * - the whole group is read with one read() on the leader
+ */
+static void perf_attr(struct perf_event_attr* attr, unsigned int counter,
+    bool kernel) {
+  memset(attr, 0, sizeof(*attr));
+
+  attr->size           = sizeof(*attr);
+  attr->type           = PERF_TYPE_HARDWARE;
+  attr->exclude_kernel = !kernel;
+  attr->exclude_hv     = 1;
+  attr->read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED
+      | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch (counter) {
+    case perf_cycles:
+      attr->config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case perf_instructions:
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case perf_llc_misses:
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case perf_branch_misses:
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case perf_dtlb_misses:
+      attr->type   = PERF_TYPE_HW_CACHE;
+      attr->config = PERF_COUNT_HW_CACHE_DTLB
+          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    default:
+      attr->type   = PERF_TYPE_SOFTWARE;
+      attr->config = PERF_COUNT_SW_TASK_CLOCK;
+      break;
+  }
+}
+
+/**
+ * Open every counter the calling thread is allowed as one group
+ * - the first counter that opens leads, errno is left at the first refusal
+ */
+static bool perf_open(perf_group* group, bool kernel) {
+  struct perf_event_attr attr;
+  unsigned int counter;
+  int error = 0;
+  int fd;
+
+  group->count = 0;
+
+  for (counter = 0; counter < perf_counter_count; counter++) {
+    perf_attr(&attr, counter, kernel);
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1,
+        ((group->count) ? group->fds[0] : -1), PERF_FLAG_FD_CLOEXEC);
+
+    if (fd < 0) {
+      error = ((error) ? error : errno);
+    } else {
+      group->fds[group->count] = fd;
+      group->ids[group->count] = counter;
+      group->count++;
+    }
+  }
+  errno = error;
+  return (group->count > 0);
+}
+
+/**
+ * Close a group (thread exit)
+ */
+static void perf_release(void* data) {
+  perf_group* group = (perf_group*) data;
+  unsigned int indx;
+
+  for (indx = group->count; indx > 0; indx--) {
+    close(group->fds[indx - 1]);
+  }
+  free(group);
+}
+
+/**
+ * The calling thread's group, opened on first use (NULL if refused)
+ */
+static perf_group* perf_thread(void) {
+  perf_group* group = (perf_group*) pthread_getspecific(perf_key);
+
+  if (group == NULL) {
+    if (!(group = (perf_group*) calloc(1, sizeof(perf_group)))) {
+      return NULL;
+    }
+    if (perf_open(group, vke_perf.kernel)) {
+      atomic_fetch_add_explicit(&vke_perf.threads, 1, memory_order_relaxed);
+    }
+    pthread_setspecific(perf_key, group);
+  }
+  return ((group->count > 0) ? group : NULL);
+}
+
+//------------------------------------------------------------------------------
+// Collection
+
+/**
+ * Start counting (--perf_counters)
+ * - kernel mode is counted too where perf_event_paranoid allows it, so
+ *   the I/O stage includes the system calls
+ * - false (and a warning) when no counter can be opened, the run goes on
+ *   without them
+ */
+bool perf_enable(config* cfg) {
+  perf_group* group;
+  perf_group* user;
+  size_t stage;
+  size_t indx;
+
+  for (stage = 0; stage < perf_stage_count; stage++) {
+    for (indx = 0; indx < perf_counter_count; indx++) {
+      atomic_init(&vke_perf.counts[stage][indx], 0);
+    }
+    atomic_init(&vke_perf.bytes[stage], 0);
+  }
+  atomic_init(&vke_perf.threads, 1);
+
+  if (pthread_key_create(&perf_key, perf_release) != 0) {
+    printf("Unable to track performance counters per thread\n");
+    return false;
+  }
+  if (!(group = (perf_group*) calloc(1, sizeof(perf_group)))
+      || !(user = (perf_group*) calloc(1, sizeof(perf_group)))) {
+    printf("Unable to allocate performance counters\n");
+    free(group);
+    return false;
+  }
+
+  // Fall back to user mode only if that gets more counters
+  vke_perf.kernel = perf_open(group, true);
+  if (group->count < perf_counter_count && perf_open(user, false)
+      && user->count > group->count) {
+    perf_release(group);
+    group = user;
+    vke_perf.kernel = false;
+  } else {
+    perf_release(user);
+  }
+
+  if (group->count == 0) {
+    printf("Unable to open performance counters (%s), check "
+        "kernel.perf_event_paranoid\n", strerror(errno));
+    free(group);
+    return false;
+  }
+  for (indx = 0; indx < group->count; indx++) {
+    vke_perf.available[group->ids[indx]] = true;
+  }
+  if (!vke_perf.available[perf_cycles] && !cfg->quiet) {
+    printf("Hardware performance counters are unavailable, only task clock "
+        "is counted\n");
+  }
+
+  pthread_setspecific(perf_key, group);
+  vke_perf.enabled = true;
+  return true;
+}
+
+/**
+ * Close the calling thread's group (other threads close theirs on exit)
+ */
+void perf_close(void) {
+  perf_group* group;
+
+  if (vke_perf.enabled && (group = (perf_group*) pthread_getspecific(perf_key))) {
+    pthread_setspecific(perf_key, NULL);
+    perf_release(group);
+  }
+}
+
+/**
+ * Read this thread's counters (sample->valid stays false on failure)
+ */
+void perf_read(perf_sample* sample) {
+  perf_group* group = perf_thread();
+  uint64_t data[3 + perf_counter_count];
+  unsigned int indx;
+
+  if (group == NULL || read(group->fds[0], data, sizeof(data))
+      < (ssize_t) ((3 + group->count) * sizeof(uint64_t))) {
+    return;
+  }
+  sample->enabled = data[1];
+  sample->running = data[2];
+  memset(sample->values, 0, sizeof(sample->values));
+
+  for (indx = 0; indx < group->count; indx++) {
+    sample->values[group->ids[indx]] = data[3 + indx];
+  }
+  sample->valid = true;
+}
+
+/**
+ * Add the counts since begin to a stage
+ * - counts are scaled up when the kernel multiplexed the group
+ */
+void perf_add(unsigned int stage, perf_sample* begin, size_t bytes) {
+  perf_sample end;
+  uint64_t enabled;
+  uint64_t running;
+  uint64_t count;
+  unsigned int indx;
+
+  end.valid = false;
+  perf_read(&end);
+
+  if (!end.valid) {
+    return;
+  }
+  enabled = end.enabled - begin->enabled;
+  running = end.running - begin->running;
+
+  for (indx = 0; indx < perf_counter_count; indx++) {
+    if (vke_perf.available[indx]) {
+      count = end.values[indx] - begin->values[indx];
+
+      if (running > 0 && running < enabled) {
+        count = (uint64_t) ((double) count * enabled / running);
+      }
+      atomic_fetch_add_explicit(&vke_perf.counts[stage][indx], count,
+          memory_order_relaxed);
+    }
+  }
+  atomic_fetch_add_explicit(&vke_perf.bytes[stage], bytes, memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// Reporting
+
+/**
+ * Cycles per byte and instructions per cycle of a stage (negative if
+ * unknown)
+ */
+static void perf_ratios(size_t stage, double* per_byte, double* ipc) {
+  uint64_t bytes        = atomic_load(&vke_perf.bytes[stage]);
+  uint64_t cycles       = atomic_load(&vke_perf.counts[stage][perf_cycles]);
+  uint64_t instructions = atomic_load(&vke_perf.counts[stage][perf_instructions]);
+
+  *per_byte = ((vke_perf.available[perf_cycles] && bytes > 0)
+      ? (double) cycles / bytes : -1);
+  *ipc = ((vke_perf.available[perf_cycles]
+      && vke_perf.available[perf_instructions] && cycles > 0)
+      ? (double) instructions / cycles : -1);
+}
+
+/**
+ * Write the counters as a JSON object (part of the --stats json report)
+ */
+void perf_json(FILE* out) {
+  double per_byte;
+  double ipc;
+  size_t stage;
+  size_t indx;
+
+  fprintf(out, "{\"mode\": \"%s\", \"threads\": %lu, \"stages\": {",
+      ((vke_perf.kernel) ? "user_kernel" : "user"),
+      (unsigned long) atomic_load(&vke_perf.threads));
+
+  for (stage = 0; stage < perf_stage_count; stage++) {
+    perf_ratios(stage, &per_byte, &ipc);
+
+    fprintf(out, "%s\n    \"%s\": {\"bytes\": %lu", (stage ? "," : ""),
+        stage_names[stage], (unsigned long) atomic_load(&vke_perf.bytes[stage]));
+
+    for (indx = 0; indx < perf_counter_count; indx++) {
+      if (vke_perf.available[indx]) {
+        fprintf(out, ", \"%s\": %lu", counter_names[indx],
+            (unsigned long) atomic_load(&vke_perf.counts[stage][indx]));
+      } else {
+        fprintf(out, ", \"%s\": null", counter_names[indx]);
+      }
+    }
+    if (per_byte < 0) {
+      fprintf(out, ", \"cycles_per_byte\": null");
+    } else {
+      fprintf(out, ", \"cycles_per_byte\": %.4f", per_byte);
+    }
+    if (ipc < 0) {
+      fprintf(out, ", \"ipc\": null}");
+    } else {
+      fprintf(out, ", \"ipc\": %.3f}", ipc);
+    }
+  }
+  fprintf(out, "\n  }}");
+}
+
+/**
+ * Write the counters as a table to stderr at exit (unless --stats json
+ * already carries them)
+ * - stages nest like the --stats phases: hashing is part of key_init and
+ *   verify includes its own sanitize, xor and io
+ */
+void perf_report(config* cfg) {
+  FILE* out = stderr;
+  double per_byte;
+  double ipc;
+  size_t stage;
+  size_t indx;
+
+  if (!vke_perf.enabled || cfg->stats) {
+    return;
+  }
+  fprintf(out, "Performance counters (%s mode, %lu threads):\n",
+      ((vke_perf.kernel) ? "user and kernel" : "user"),
+      (unsigned long) atomic_load(&vke_perf.threads));
+  fprintf(out, "  %-9s %14s %11s %6s %14s %14s %12s %13s %12s %10s\n",
+      "stage", "bytes", "cycles/byte", "IPC", "cycles", "instructions",
+      "llc_misses", "branch_misses", "dtlb_misses", "task_ms");
+
+  for (stage = 0; stage < perf_stage_count; stage++) {
+    perf_ratios(stage, &per_byte, &ipc);
+
+    fprintf(out, "  %-9s %14lu", stage_names[stage],
+        (unsigned long) atomic_load(&vke_perf.bytes[stage]));
+
+    if (per_byte < 0) {
+      fprintf(out, " %11s", "-");
+    } else {
+      fprintf(out, " %11.3f", per_byte);
+    }
+    if (ipc < 0) {
+      fprintf(out, " %6s", "-");
+    } else {
+      fprintf(out, " %6.2f", ipc);
+    }
+
+    for (indx = 0; indx < perf_counter_count; indx++) {
+      int width = ((indx == perf_cycles || indx == perf_instructions) ? 14
+          : (indx == perf_branch_misses) ? 13
+          : (indx == perf_task_clock) ? 10 : 12);
+
+      if (!vke_perf.available[indx]) {
+        fprintf(out, " %*s", width, "-");
+      } else if (indx == perf_task_clock) {
+        fprintf(out, " %*.1f", width,
+            atomic_load(&vke_perf.counts[stage][indx]) / 1e6);
+      } else {
+        fprintf(out, " %*lu", width,
+            (unsigned long) atomic_load(&vke_perf.counts[stage][indx]));
+      }
+    }
+    fprintf(out, "\n");
+  }
+  fflush(out);
+}
@@ -0,0 +1,129 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdlib.h>    // malloc, calloc, free
+#include <pthread.h>   // pthread_mutex_init, pthread_mutex_lock,
+                       // pthread_mutex_unlock, pthread_mutex_destroy
+
+#include <alias.h>     // arena_align, bool, true, false
+#include <utility.h>   // alloc_buffer, free_buffer
+#include <pool.h>
+
+//------------------------------------------------------------------------------
+// Arena
+
+/**
+ * Create an empty arena that grows in blocks of (at least) block bytes
+ */
+void arena_init(arena* mem, size_t block) {
+  mem->blocks = NULL;
+  mem->block  = block;
+  pthread_mutex_init(&mem->lock, NULL);
+}
+
+/**
+ * Allocate size bytes (arena_align aligned), NULL if out of memory
+ */
+void* arena_alloc(arena* mem, size_t size) {
+  size_t header = ((sizeof(arena_block) + arena_align - 1) / arena_align) * arena_align;
+  arena_block* current;
+  void* data = NULL;
+
+  size = ((size + arena_align - 1) / arena_align) * arena_align;
+
+  pthread_mutex_lock(&mem->lock);
+  current = mem->blocks;
+
+  if (current == NULL || current->size - current->used < size) {
+    size_t length = ((size > mem->block) ? size : mem->block);
+
+    if ((current = (arena_block*) malloc(header + length)) != NULL) {
+      current->next = mem->blocks;
+      current->size = length;
+      current->used = 0;
+      mem->blocks   = current;
+    }
+  }
+  if (current != NULL) {
+    data           = (char*) current + header + current->used;
+    current->used += size;
+  }
+  pthread_mutex_unlock(&mem->lock);
+  return data;
+}
+
+/**
+ * Release the arena and everything allocated from it
+ */
+void arena_free(arena* mem) {
+  arena_block* current = mem->blocks;
+  arena_block* next;
+
+  while (current != NULL) {
+    next = current->next;
+    free(current);
+    current = next;
+  }
+  mem->blocks = NULL;
+  pthread_mutex_destroy(&mem->lock);
+}
+
+//------------------------------------------------------------------------------
+// Buffer pool
+
+/**
+ * Create a pool of up to capacity buffers of size bytes (none allocated yet)
+ */
+bool pool_init(pool* buffers, size_t size, size_t capacity) {
+  buffers->size     = size;
+  buffers->capacity = capacity;
+  buffers->count    = 0;
+  buffers->created  = 0;
+
+  if (!(buffers->idle = (char**) calloc(capacity, sizeof(char*)))) {
+    return false;
+  }
+  pthread_mutex_init(&buffers->lock, NULL);
+  return true;
+}
+
+/**
+ * Take a buffer, NULL once all capacity buffers are taken (or out of memory)
+ */
+char* pool_take(pool* buffers) {
+  char* buff = NULL;
+
+  pthread_mutex_lock(&buffers->lock);
+  if (buffers->count > 0) {
+    buff = buffers->idle[--buffers->count];
+  } else if (buffers->created < buffers->capacity
+      && (buff = alloc_buffer(buffers->size)) != NULL) {
+    buffers->created++;
+  }
+  pthread_mutex_unlock(&buffers->lock);
+  return buff;
+}
+
+/**
+ * Hand a buffer back for the next taker
+ */
+void pool_give(pool* buffers, char* buff) {
+  pthread_mutex_lock(&buffers->lock);
+  buffers->idle[buffers->count++] = buff;
+  pthread_mutex_unlock(&buffers->lock);
+}
+
+/**
+ * Release the pool (every buffer must have been handed back)
+ */
+void pool_free(pool* buffers) {
+  if (buffers->idle == NULL) {
+    return;
+  }
+  while (buffers->count > 0) {
+    free_buffer(buffers->idle[--buffers->count], buffers->size);
+  }
+  pthread_mutex_destroy(&buffers->lock);
+  free(buffers->idle);
+  buffers->idle = NULL;
+}
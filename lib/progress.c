@@ -0,0 +1,196 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>     // printf, snprintf, fprintf, dprintf, stderr
+#include <string.h>    // strlen
+#include <unistd.h>    // isatty, STDERR_FILENO
+#include <time.h>      // clock_gettime, CLOCK_MONOTONIC, timespec
+#include <pthread.h>   // pthread_create, pthread_join, pthread_mutex_*,
+                       // pthread_cond_*, pthread_condattr_*
+#include <stdatomic.h> // atomic_load_explicit
+
+#include <alias.h>     // progress_interval, bool, true, false
+#include <data.h>      // config, layer, progress
+#include <stats.h>     // vke_stats, stats_count, stats_clock
+#include <progress.h>
+
+//------------------------------------------------------------------------------
+// Timer thread
+
+/**
+ * Start reporting progress until progress_stop()
+ * - the combine paths count bytes, nothing else changes for them
+ */
+bool progress_start(progress* prog, config* cfg) {
+  pthread_condattr_t attr;
+
+  prog->cfg        = cfg;
+  prog->start      = stats_clock();
+  prog->last       = prog->start;
+  prog->last_bytes = 0;
+  prog->average    = 0;
+  prog->terminal   = (cfg->progress && isatty(STDERR_FILENO));
+  prog->stop       = false;
+  prog->started    = false;
+
+  stats_count();
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&prog->wake, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&prog->lock, NULL);
+
+  if (pthread_create(&prog->thread, NULL, progress_timer, prog) != 0) {
+    printf("Unable to start progress reporting\n");
+    pthread_cond_destroy(&prog->wake);
+    pthread_mutex_destroy(&prog->lock);
+    return false;
+  }
+  prog->started = true;
+  return true;
+}
+
+/**
+ * Stop the timer thread and report the final state
+ */
+void progress_stop(progress* prog) {
+  if (!prog->started) {
+    return;
+  }
+  pthread_mutex_lock(&prog->lock);
+  prog->stop = true;
+  pthread_cond_signal(&prog->wake);
+  pthread_mutex_unlock(&prog->lock);
+
+  pthread_join(prog->thread, NULL);
+  pthread_cond_destroy(&prog->wake);
+  pthread_mutex_destroy(&prog->lock);
+
+  progress_report(prog, true);
+  prog->started = false;
+}
+
+/**
+ * Report every progress_interval until stopped
+ */
+void* progress_timer(void* data) {
+  progress* prog = (progress*) data;
+  struct timespec until;
+
+  clock_gettime(CLOCK_MONOTONIC, &until);
+  pthread_mutex_lock(&prog->lock);
+
+  while (!prog->stop) {
+    until.tv_nsec += (progress_interval % 1000) * 1000000L;
+    until.tv_sec  += (progress_interval / 1000) + (until.tv_nsec / 1000000000L);
+    until.tv_nsec %= 1000000000L;
+
+    while (!prog->stop
+        && pthread_cond_timedwait(&prog->wake, &prog->lock, &until) == 0) {
+    }
+    if (!prog->stop) {
+      pthread_mutex_unlock(&prog->lock);
+      progress_report(prog, false);
+      pthread_mutex_lock(&prog->lock);
+    }
+  }
+  pthread_mutex_unlock(&prog->lock);
+  return NULL;
+}
+
+//------------------------------------------------------------------------------
+// Reporting
+
+/**
+ * Format a byte count with a binary unit
+ */
+static void progress_size(char* buff, size_t length, double bytes) {
+  const char* units = "BKMGTP";
+
+  while (bytes >= 1024 && units[1] != '\0') {
+    bytes /= 1024;
+    units++;
+  }
+  snprintf(buff, length, "%.*f%c%s", ((*units == 'B') ? 0 : 2), bytes, *units,
+      ((*units == 'B') ? "" : "B"));
+}
+
+/**
+ * Print one progress sample
+ * - current MB/s is over the last interval, the moving average weighs
+ *   each new interval by a fifth (the final sample reports the average
+ *   over the whole run instead)
+ * - the total grows as batch and recursive sources are found, so their
+ *   ETA firms up as the walk completes
+ * - --progress writes a line to stderr, --progress_fd a JSON object per
+ *   line to the given descriptor
+ */
+void progress_report(progress* prog, bool final) {
+  config* cfg    = prog->cfg;
+  uint64_t now   = stats_clock();
+  uint64_t bytes = atomic_load_explicit(&vke_stats.bytes_combined, memory_order_relaxed);
+  uint64_t total = atomic_load_explicit(&vke_stats.bytes_total, memory_order_relaxed);
+  double elapsed = (now - prog->start) / 1e9;
+  double period  = (now - prog->last) / 1e9;
+  double current = ((period > 0) ? ((bytes - prog->last_bytes) / 1048576.0) / period : 0);
+  double percent = ((total > 0) ? (100.0 * bytes) / total : 0);
+  double eta     = -1;
+  char done[64];
+  char size[32];
+  layer* layr;
+
+  if (!final) {
+    prog->average = ((prog->last == prog->start) ? current
+        : prog->average + ((current - prog->average) / 5));
+  } else if (elapsed > 0) {
+    prog->average = (bytes / 1048576.0) / elapsed;
+  }
+  if (total > bytes && prog->average > 0) {
+    eta = ((total - bytes) / 1048576.0) / prog->average;
+  } else if (total > 0) {
+    eta = 0;
+  }
+  prog->last       = now;
+  prog->last_bytes = bytes;
+
+  if (cfg->progress) {
+    char remaining[32] = "--:--:--";
+
+    if (eta >= 0) {
+      snprintf(remaining, sizeof(remaining), "%lu:%02lu:%02lu", (unsigned long) eta / 3600,
+          ((unsigned long) eta / 60) % 60, (unsigned long) eta % 60);
+    }
+    progress_size(done, sizeof(done), bytes);
+
+    if (total > 0) {
+      progress_size(size, sizeof(size), total);
+      snprintf(done + strlen(done), sizeof(done) - strlen(done), " of %s (%.1f%%)", size, percent);
+    }
+    fprintf(stderr, "%sProgress: %s, %.1fMB/s now, %.1fMB/s avg, ETA %s%s",
+        (prog->terminal ? "\r" : ""), done, current, prog->average, remaining,
+        (prog->terminal ? ((final) ? "\033[K\n" : "\033[K") : "\n"));
+    fflush(stderr);
+  }
+
+  if (cfg->progress_fd >= 0) {
+    dprintf(cfg->progress_fd, "{\"elapsed\": %.3f, \"bytes\": %lu, \"total\": %lu, \"percent\": %.2f, "
+        "\"mb_per_s\": %.2f, \"avg_mb_per_s\": %.2f, \"eta_seconds\": ", elapsed, (unsigned long) bytes,
+        (unsigned long) total, percent, current, prog->average);
+    if (eta >= 0) {
+      dprintf(cfg->progress_fd, "%.1f", eta);
+    } else {
+      dprintf(cfg->progress_fd, "null");
+    }
+    dprintf(cfg->progress_fd, ", \"layers\": [");
+
+    for (layr = cfg->keys; layr < cfg->keys + cfg->key_length; layr++) {
+      uint64_t count = atomic_load_explicit(&layr->bytes, memory_order_relaxed);
+
+      dprintf(cfg->progress_fd, "%s{\"index\": %u, \"bytes\": %lu, \"percent\": %.2f}",
+          ((layr == cfg->keys) ? "" : ", "), layr->indx, (unsigned long) count,
+          ((total > 0) ? (100.0 * count) / total : 0));
+    }
+    dprintf(cfg->progress_fd, "], \"done\": %s}\n", ((final) ? "true" : "false"));
+  }
+}
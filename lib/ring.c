@@ -0,0 +1,88 @@
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdlib.h>    // calloc, free
+#include <stdatomic.h> // atomic_load_explicit, atomic_store_explicit
+#include <sched.h>     // sched_yield
+#include <time.h>      // nanosleep
+
+#include <alias.h>     // bool, true, false
+#include <ring.h>
+
+//------------------------------------------------------------------------------
+// Initialization
+
+/**
+ * Create an empty ring that holds up to capacity items
+ */
+bool ring_init(ring* rng, size_t capacity) {
+  rng->capacity = capacity + 1;
+
+  if (!(rng->slots = (void**) calloc(rng->capacity, sizeof(void*)))) {
+    return false;
+  }
+  atomic_init(&rng->head, 0);
+  atomic_init(&rng->tail, 0);
+  return true;
+}
+
+void ring_free(ring* rng) {
+  if (rng->slots != NULL) {
+    free(rng->slots);
+    rng->slots = NULL;
+  }
+}
+
+//------------------------------------------------------------------------------
+// Ring operations
+//
+// The producer only ever writes head and the consumer only ever writes tail,
+// so an acquire load of the other side's index is all the synchronization
+// needed.
+
+/**
+ * Add an item (producer side), false if the ring is full
+ */
+bool ring_push(ring* rng, void* item) {
+  size_t head = atomic_load_explicit(&rng->head, memory_order_relaxed);
+  size_t next = (head + 1) % rng->capacity;
+
+  if (next == atomic_load_explicit(&rng->tail, memory_order_acquire)) {
+    return false;
+  }
+  rng->slots[head] = item;
+  atomic_store_explicit(&rng->head, next, memory_order_release);
+  return true;
+}
+
+/**
+ * Remove the oldest item (consumer side), NULL if the ring is empty
+ */
+void* ring_pop(ring* rng) {
+  size_t tail = atomic_load_explicit(&rng->tail, memory_order_relaxed);
+  void* item;
+
+  if (tail == atomic_load_explicit(&rng->head, memory_order_acquire)) {
+    return NULL;
+  }
+  item = rng->slots[tail];
+  atomic_store_explicit(&rng->tail, (tail + 1) % rng->capacity,
+      memory_order_release);
+  return item;
+}
+
+/**
+ * Back off while waiting on a ring
+ * - yield first, then sleep briefly so a stage blocked on slow I/O does
+ *   not burn a core
+ */
+void ring_wait(unsigned int* spins) {
+  struct timespec pause = { 0, 50000 };
+
+  if ((*spins)++ < 64) {
+    sched_yield();
+  } else {
+    nanosleep(&pause, NULL);
+  }
+}
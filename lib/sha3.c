@@ -156,7 +156,13 @@ static void keccak_chi(uint64_t *A)
   }
 }
 
-static void rhash_sha3_permutation(uint64_t *state)
+/**
+ * Reference permutation, one pass over state[] per step (kept to check the
+ * optimized variants against).
+ *
+ * @param state the algorithm state
+ */
+void rhash_sha3_permutation_reference(uint64_t *state)
 {
   int round;
   for (round = 0; round < NumberOfRounds; round++)
@@ -197,6 +203,270 @@ static void rhash_sha3_permutation(uint64_t *state)
   }
 }
 
+/*
+ * Register resident permutation.
+ *
+ * All 24 rounds are unrolled, each round reads the lanes A00..A24 and writes
+ * E00..E24 (and the next round the other way round), so the state stays in
+ * registers.  Theta, rho and pi are folded into the five B values feeding
+ * each chi row.
+ *
+ * With lane complementing the lanes 1, 2, 8, 12, 17 and 20 are kept
+ * inverted, which turns chi into AND / OR with one NOT per row instead of
+ * five (see the Keccak implementation overview, section 2.2).  CPUs with
+ * ANDN (BMI1) get the plain chi instead.
+ */
+#define KECCAK_THETA(A)                                      \
+  C0 = A##00 ^ A##05 ^ A##10 ^ A##15 ^ A##20;                \
+  C1 = A##01 ^ A##06 ^ A##11 ^ A##16 ^ A##21;                \
+  C2 = A##02 ^ A##07 ^ A##12 ^ A##17 ^ A##22;                \
+  C3 = A##03 ^ A##08 ^ A##13 ^ A##18 ^ A##23;                \
+  C4 = A##04 ^ A##09 ^ A##14 ^ A##19 ^ A##24;                \
+  D0 = C4 ^ ROTL64(C1, 1);                                   \
+  D1 = C0 ^ ROTL64(C2, 1);                                   \
+  D2 = C1 ^ ROTL64(C3, 1);                                   \
+  D3 = C2 ^ ROTL64(C4, 1);                                   \
+  D4 = C3 ^ ROTL64(C0, 1);
+
+#define KECCAK_CHI_LC0(E)                                    \
+  E##00 = B0 ^ (B1 | B2);                                    \
+  E##01 = B1 ^ ((~B2) | B3);                                 \
+  E##02 = B2 ^ (B3 & B4);                                    \
+  E##03 = B3 ^ (B4 | B0);                                    \
+  E##04 = B4 ^ (B0 & B1);
+
+#define KECCAK_CHI_LC1(E)                                    \
+  E##05 = B0 ^ (B1 | B2);                                    \
+  E##06 = B1 ^ (B2 & B3);                                    \
+  E##07 = B2 ^ (B3 | (~B4));                                 \
+  E##08 = B3 ^ (B4 | B0);                                    \
+  E##09 = B4 ^ (B0 & B1);
+
+#define KECCAK_CHI_LC2(E)                                    \
+  E##10 = B0 ^ (B1 | B2);                                    \
+  E##11 = B1 ^ (B2 & B3);                                    \
+  E##12 = B2 ^ ((~B3) & B4);                                 \
+  E##13 = (~B3) ^ (B4 | B0);                                 \
+  E##14 = B4 ^ (B0 & B1);
+
+#define KECCAK_CHI_LC3(E)                                    \
+  E##15 = B0 ^ (B1 & B2);                                    \
+  E##16 = B1 ^ (B2 | B3);                                    \
+  E##17 = B2 ^ ((~B3) | B4);                                 \
+  E##18 = (~B3) ^ (B4 & B0);                                 \
+  E##19 = B4 ^ (B0 | B1);
+
+#define KECCAK_CHI_LC4(E)                                    \
+  E##20 = B0 ^ ((~B1) & B2);                                 \
+  E##21 = (~B1) ^ (B2 | B3);                                 \
+  E##22 = B2 ^ (B3 & B4);                                    \
+  E##23 = B3 ^ (B4 | B0);                                    \
+  E##24 = B4 ^ (B0 & B1);
+
+#define KECCAK_CHI0(E)                                       \
+  E##00 = B0 ^ (~B1 & B2);                                   \
+  E##01 = B1 ^ (~B2 & B3);                                   \
+  E##02 = B2 ^ (~B3 & B4);                                   \
+  E##03 = B3 ^ (~B4 & B0);                                   \
+  E##04 = B4 ^ (~B0 & B1);
+
+#define KECCAK_CHI1(E)                                       \
+  E##05 = B0 ^ (~B1 & B2);                                   \
+  E##06 = B1 ^ (~B2 & B3);                                   \
+  E##07 = B2 ^ (~B3 & B4);                                   \
+  E##08 = B3 ^ (~B4 & B0);                                   \
+  E##09 = B4 ^ (~B0 & B1);
+
+#define KECCAK_CHI2(E)                                       \
+  E##10 = B0 ^ (~B1 & B2);                                   \
+  E##11 = B1 ^ (~B2 & B3);                                   \
+  E##12 = B2 ^ (~B3 & B4);                                   \
+  E##13 = B3 ^ (~B4 & B0);                                   \
+  E##14 = B4 ^ (~B0 & B1);
+
+#define KECCAK_CHI3(E)                                       \
+  E##15 = B0 ^ (~B1 & B2);                                   \
+  E##16 = B1 ^ (~B2 & B3);                                   \
+  E##17 = B2 ^ (~B3 & B4);                                   \
+  E##18 = B3 ^ (~B4 & B0);                                   \
+  E##19 = B4 ^ (~B0 & B1);
+
+#define KECCAK_CHI4(E)                                       \
+  E##20 = B0 ^ (~B1 & B2);                                   \
+  E##21 = B1 ^ (~B2 & B3);                                   \
+  E##22 = B2 ^ (~B3 & B4);                                   \
+  E##23 = B3 ^ (~B4 & B0);                                   \
+  E##24 = B4 ^ (~B0 & B1);
+
+#define KECCAK_ROUND(A, E, rc, CHI)                          \
+  KECCAK_THETA(A)                                            \
+  B0 = A##00 ^ D0;                                           \
+  B1 = ROTL64(A##06 ^ D1, 44);                               \
+  B2 = ROTL64(A##12 ^ D2, 43);                               \
+  B3 = ROTL64(A##18 ^ D3, 21);                               \
+  B4 = ROTL64(A##24 ^ D4, 14);                               \
+  CHI##0(E)                                                  \
+  B0 = ROTL64(A##03 ^ D3, 28);                               \
+  B1 = ROTL64(A##09 ^ D4, 20);                               \
+  B2 = ROTL64(A##10 ^ D0, 3);                                \
+  B3 = ROTL64(A##16 ^ D1, 45);                               \
+  B4 = ROTL64(A##22 ^ D2, 61);                               \
+  CHI##1(E)                                                  \
+  B0 = ROTL64(A##01 ^ D1, 1);                                \
+  B1 = ROTL64(A##07 ^ D2, 6);                                \
+  B2 = ROTL64(A##13 ^ D3, 25);                               \
+  B3 = ROTL64(A##19 ^ D4, 8);                                \
+  B4 = ROTL64(A##20 ^ D0, 18);                               \
+  CHI##2(E)                                                  \
+  B0 = ROTL64(A##04 ^ D4, 27);                               \
+  B1 = ROTL64(A##05 ^ D0, 36);                               \
+  B2 = ROTL64(A##11 ^ D1, 10);                               \
+  B3 = ROTL64(A##17 ^ D2, 15);                               \
+  B4 = ROTL64(A##23 ^ D3, 56);                               \
+  CHI##3(E)                                                  \
+  B0 = ROTL64(A##02 ^ D2, 62);                               \
+  B1 = ROTL64(A##08 ^ D3, 55);                               \
+  B2 = ROTL64(A##14 ^ D4, 39);                               \
+  B3 = ROTL64(A##15 ^ D0, 41);                               \
+  B4 = ROTL64(A##21 ^ D1, 2);                                \
+  CHI##4(E)                                                  \
+  E##00 ^= (rc);
+
+#define KECCAK_COMPLEMENT(A) \
+  A##01 = ~A##01;            \
+  A##02 = ~A##02;            \
+  A##08 = ~A##08;            \
+  A##12 = ~A##12;            \
+  A##17 = ~A##17;            \
+  A##20 = ~A##20;
+
+#define KECCAK_ROUNDS(CHI, RC)                                 \
+  KECCAK_ROUND(a, e, RC(0), CHI)                               \
+  KECCAK_ROUND(e, a, RC(1), CHI)                               \
+  KECCAK_ROUND(a, e, RC(2), CHI)                               \
+  KECCAK_ROUND(e, a, RC(3), CHI)                               \
+  KECCAK_ROUND(a, e, RC(4), CHI)                               \
+  KECCAK_ROUND(e, a, RC(5), CHI)                               \
+  KECCAK_ROUND(a, e, RC(6), CHI)                               \
+  KECCAK_ROUND(e, a, RC(7), CHI)                               \
+  KECCAK_ROUND(a, e, RC(8), CHI)                               \
+  KECCAK_ROUND(e, a, RC(9), CHI)                               \
+  KECCAK_ROUND(a, e, RC(10), CHI)                              \
+  KECCAK_ROUND(e, a, RC(11), CHI)                              \
+  KECCAK_ROUND(a, e, RC(12), CHI)                              \
+  KECCAK_ROUND(e, a, RC(13), CHI)                              \
+  KECCAK_ROUND(a, e, RC(14), CHI)                              \
+  KECCAK_ROUND(e, a, RC(15), CHI)                              \
+  KECCAK_ROUND(a, e, RC(16), CHI)                              \
+  KECCAK_ROUND(e, a, RC(17), CHI)                              \
+  KECCAK_ROUND(a, e, RC(18), CHI)                              \
+  KECCAK_ROUND(e, a, RC(19), CHI)                              \
+  KECCAK_ROUND(a, e, RC(20), CHI)                              \
+  KECCAK_ROUND(e, a, RC(21), CHI)                              \
+  KECCAK_ROUND(a, e, RC(22), CHI)                              \
+  KECCAK_ROUND(e, a, RC(23), CHI)
+
+#define KECCAK_LANES(T)                                                            \
+  T a00, a01, a02, a03, a04, a05, a06, a07, a08, a09, a10, a11, a12;               \
+  T a13, a14, a15, a16, a17, a18, a19, a20, a21, a22, a23, a24;                    \
+  T e00, e01, e02, e03, e04, e05, e06, e07, e08, e09, e10, e11, e12;               \
+  T e13, e14, e15, e16, e17, e18, e19, e20, e21, e22, e23, e24;                    \
+  T B0, B1, B2, B3, B4, C0, C1, C2, C3, C4, D0, D1, D2, D3, D4
+
+#define KECCAK_LOAD(S, p)                                                          \
+  a00 = S(p, 0); a01 = S(p, 1); a02 = S(p, 2); a03 = S(p, 3); a04 = S(p, 4);       \
+  a05 = S(p, 5); a06 = S(p, 6); a07 = S(p, 7); a08 = S(p, 8); a09 = S(p, 9);       \
+  a10 = S(p, 10); a11 = S(p, 11); a12 = S(p, 12); a13 = S(p, 13); a14 = S(p, 14);  \
+  a15 = S(p, 15); a16 = S(p, 16); a17 = S(p, 17); a18 = S(p, 18); a19 = S(p, 19);  \
+  a20 = S(p, 20); a21 = S(p, 21); a22 = S(p, 22); a23 = S(p, 23); a24 = S(p, 24)
+
+#define KECCAK_STORE(S, p)                                                         \
+  S(p, 0) = a00; S(p, 1) = a01; S(p, 2) = a02; S(p, 3) = a03; S(p, 4) = a04;       \
+  S(p, 5) = a05; S(p, 6) = a06; S(p, 7) = a07; S(p, 8) = a08; S(p, 9) = a09;       \
+  S(p, 10) = a10; S(p, 11) = a11; S(p, 12) = a12; S(p, 13) = a13; S(p, 14) = a14;  \
+  S(p, 15) = a15; S(p, 16) = a16; S(p, 17) = a17; S(p, 18) = a18; S(p, 19) = a19;  \
+  S(p, 20) = a20; S(p, 21) = a21; S(p, 22) = a22; S(p, 23) = a23; S(p, 24) = a24
+
+#define KECCAK_LANE(state, i) ((state)[i])
+#define KECCAK_RC(round) keccak_round_constants[round]
+
+/**
+ * Unrolled permutation with lane complementing (portable).
+ *
+ * @param state the algorithm state
+ */
+void rhash_sha3_permutation_unrolled(uint64_t *state)
+{
+  KECCAK_LANES(uint64_t);
+
+  KECCAK_LOAD(KECCAK_LANE, state);
+  KECCAK_COMPLEMENT(a)
+  KECCAK_ROUNDS(KECCAK_CHI_LC, KECCAK_RC)
+  KECCAK_COMPLEMENT(a)
+  KECCAK_STORE(KECCAK_LANE, state);
+}
+
+/**
+ * Four interleaved states (lanes[4 * i + n] is lane i of state n), one
+ * after another.
+ *
+ * @param lanes the interleaved algorithm states
+ */
+void rhash_sha3_permutation_x4_generic(uint64_t *lanes)
+{
+  uint64_t state[sha3_max_permutation_size];
+  int n, i;
+
+  for (n = 0; n < 4; n++) {
+    for (i = 0; i < sha3_max_permutation_size; i++) state[i] = lanes[4 * i + n];
+    rhash_sha3_permutation(state);
+    for (i = 0; i < sha3_max_permutation_size; i++) lanes[4 * i + n] = state[i];
+  }
+}
+
+#ifdef RHASH_SHA3_X86
+/**
+ * Unrolled permutation with the plain chi, for ANDN and RORX (BMI1/BMI2).
+ *
+ * @param state the algorithm state
+ */
+__attribute__((target("bmi,bmi2")))
+void rhash_sha3_permutation_bmi2(uint64_t *state)
+{
+  KECCAK_LANES(uint64_t);
+
+  KECCAK_LOAD(KECCAK_LANE, state);
+  KECCAK_ROUNDS(KECCAK_CHI, KECCAK_RC)
+  KECCAK_STORE(KECCAK_LANE, state);
+}
+
+/* four 64-bit lanes, one per state, in a 256-bit register */
+typedef uint64_t keccak_x4 __attribute__((vector_size(32), aligned(8)));
+
+#define KECCAK_LANE_X4(lanes, i) (*(keccak_x4*)((lanes) + 4 * (i)))
+#define KECCAK_RC_X4(round) ((keccak_x4) { KECCAK_RC(round), KECCAK_RC(round), \
+    KECCAK_RC(round), KECCAK_RC(round) })
+
+/**
+ * Four interleaved states at once, one state per AVX2 register lane.
+ *
+ * @param lanes the interleaved algorithm states
+ */
+__attribute__((target("avx2")))
+void rhash_sha3_permutation_x4_avx2(uint64_t *lanes)
+{
+  KECCAK_LANES(keccak_x4);
+
+  KECCAK_LOAD(KECCAK_LANE_X4, lanes);
+  KECCAK_ROUNDS(KECCAK_CHI, KECCAK_RC_X4)
+  KECCAK_STORE(KECCAK_LANE_X4, lanes);
+}
+#endif /* RHASH_SHA3_X86 */
+
+/* permutations selected for the running CPU (see init_kernels) */
+void (*rhash_sha3_permutation)(uint64_t *state) = rhash_sha3_permutation_unrolled;
+void (*rhash_sha3_permutation_x4)(uint64_t *lanes) = rhash_sha3_permutation_x4_generic;
+
 /**
  * The core transformation. Process the specified block of data.
  *
@@ -0,0 +1,268 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>        // fprintf, fputc, stderr
+#include <time.h>         // clock_gettime, CLOCK_MONOTONIC
+#include <stdatomic.h>    // atomic_init, atomic_load, atomic_fetch_add_explicit
+#include <sys/resource.h> // getrusage, RUSAGE_SELF
+
+#include <alias.h>        // phase_*, call_*, bool, true, false
+#include <data.h>         // config, layer, stats
+#include <perf.h>         // vke_perf, perf_json
+#include <stats.h>
+
+//------------------------------------------------------------------------------
+// Shared state
+
+stats vke_stats;
+
+static const char* phase_names[phase_count] = {
+  "key_init", "hashing", "check", "verify", "combine",
+  "read_wait", "write_wait", "uring_wait", "compute", "output_close"
+};
+
+static const char* call_names[call_count] = {
+  "read", "write", "sync", "uring_enter", "map", "other"
+};
+
+//------------------------------------------------------------------------------
+// Collection
+//
+// Everything is a no-op until stats_enable() (or stats_count() for the
+// byte counters alone) is called, so the I/O and combine paths can call in
+// unconditionally.  Counters are relaxed atomics, threads only ever add to
+// them.
+
+/**
+ * Start collecting (--stats), wall time counts from start
+ */
+void stats_enable(uint64_t start) {
+  size_t indx;
+
+  for (indx = 0; indx < phase_count; indx++) {
+    atomic_init(&vke_stats.times[indx], 0);
+  }
+  for (indx = 0; indx < call_count; indx++) {
+    atomic_init(&vke_stats.calls[indx], 0);
+  }
+  atomic_init(&vke_stats.bytes_read, 0);
+  atomic_init(&vke_stats.bytes_written, 0);
+  atomic_init(&vke_stats.bytes_combined, 0);
+  atomic_init(&vke_stats.bytes_total, 0);
+
+  vke_stats.start    = start;
+  vke_stats.enabled  = true;
+  vke_stats.counting = true;
+}
+
+/**
+ * Count combined bytes only (--progress without --stats)
+ */
+void stats_count(void) {
+  if (!vke_stats.counting) {
+    atomic_init(&vke_stats.bytes_combined, 0);
+    atomic_init(&vke_stats.bytes_total, 0);
+    vke_stats.counting = true;
+  }
+}
+
+/**
+ * Whether combined bytes are counted
+ */
+bool stats_counting(void) {
+  return vke_stats.counting;
+}
+
+/**
+ * Monotonic wall clock in nanoseconds
+ */
+uint64_t stats_clock(void) {
+  struct timespec time;
+
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return ((uint64_t) time.tv_sec * 1000000000) + time.tv_nsec;
+}
+
+/**
+ * Start timing a phase (0 when not collecting)
+ */
+uint64_t stats_begin(void) {
+  return ((vke_stats.enabled) ? stats_clock() : 0);
+}
+
+/**
+ * Nanoseconds since stats_begin() (0 when not collecting)
+ */
+uint64_t stats_since(uint64_t begin) {
+  return ((begin) ? stats_clock() - begin : 0);
+}
+
+/**
+ * Add the time since begin to a phase
+ */
+void stats_phase(unsigned int phase, uint64_t begin) {
+  if (begin) {
+    atomic_fetch_add_explicit(&vke_stats.times[phase], stats_clock() - begin,
+        memory_order_relaxed);
+  }
+}
+
+/**
+ * Add time spent on a key layer to the layer and its phase
+ */
+void stats_layer(layer* layr, unsigned int phase, uint64_t time) {
+  if (vke_stats.enabled) {
+    atomic_fetch_add_explicit(&layr->times[phase], time, memory_order_relaxed);
+    atomic_fetch_add_explicit(&vke_stats.times[phase], time, memory_order_relaxed);
+  }
+}
+
+/**
+ * Count a system call
+ */
+void stats_call(unsigned int call) {
+  if (vke_stats.enabled) {
+    atomic_fetch_add_explicit(&vke_stats.calls[call], 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * Count bytes read (call_read) or written (call_write)
+ */
+void stats_bytes(unsigned int call, size_t bytes) {
+  if (vke_stats.enabled) {
+    atomic_fetch_add_explicit(((call == call_write)
+        ? &vke_stats.bytes_written : &vke_stats.bytes_read), bytes,
+        memory_order_relaxed);
+  }
+}
+
+/**
+ * Count bytes combined with a key layer (NULL counts source bytes)
+ */
+void stats_combined(layer* layr, size_t bytes) {
+  if (vke_stats.counting) {
+    atomic_fetch_add_explicit(((layr != NULL) ? &layr->bytes
+        : &vke_stats.bytes_combined), bytes, memory_order_relaxed);
+  }
+}
+
+/**
+ * Add source bytes still to be combined (sources as they are found)
+ */
+void stats_total(size_t bytes) {
+  if (vke_stats.counting) {
+    atomic_fetch_add_explicit(&vke_stats.bytes_total, bytes,
+        memory_order_relaxed);
+  }
+}
+
+//------------------------------------------------------------------------------
+// Reporting
+
+/**
+ * Write a JSON string (quoted and escaped)
+ */
+static void stats_string(FILE* out, const char* str) {
+  fputc('"', out);
+
+  for (; *str != '\0'; str++) {
+    if (*str == '"' || *str == '\\') {
+      fprintf(out, "\\%c", *str);
+    } else if ((unsigned char) *str < 0x20) {
+      fprintf(out, "\\u%04x", (unsigned char) *str);
+    } else {
+      fputc(*str, out);
+    }
+  }
+  fputc('"', out);
+}
+
+static double stats_seconds(uint64_t time) {
+  return time / 1e9;
+}
+
+/**
+ * Write the collected statistics as one JSON document to stderr
+ * - text keys are secrets, only file keys are named
+ */
+void stats_report(config* cfg, const char* version, int status) {
+  FILE* out = stderr;
+  uint64_t wall     = stats_clock() - vke_stats.start;
+  uint64_t combine  = atomic_load(&vke_stats.times[phase_combine]);
+  uint64_t combined = atomic_load(&vke_stats.bytes_combined);
+  uint64_t total    = 0;
+  struct rusage usage;
+  layer* layr;
+  size_t indx;
+
+  if (!vke_stats.enabled) {
+    return;
+  }
+  getrusage(RUSAGE_SELF, &usage);
+
+  fprintf(out, "{\n  \"version\": ");
+  stats_string(out, version);
+  fprintf(out, ",\n  \"status\": %d,\n  \"wall_seconds\": %.6f,\n", status, stats_seconds(wall));
+  fprintf(out, "  \"threads\": %u,\n  \"buffer_size\": %lu,\n  \"keystream\": %u,\n", cfg->threads, cfg->buffer_size, cfg->keystream);
+
+  fprintf(out, "  \"phases\": {");
+  for (indx = 0; indx < phase_count; indx++) {
+    fprintf(out, "%s\"%s\": %.6f", (indx ? ", " : ""), phase_names[indx],
+        stats_seconds(atomic_load(&vke_stats.times[indx])));
+  }
+  fprintf(out, "},\n");
+
+  fprintf(out, "  \"bytes\": {\"read\": %lu, \"written\": %lu, \"combined\": %lu},\n",
+      (unsigned long) atomic_load(&vke_stats.bytes_read),
+      (unsigned long) atomic_load(&vke_stats.bytes_written), (unsigned long) combined);
+  fprintf(out, "  \"combine_mb_per_s\": %.2f,\n",
+      (combine > 0) ? (combined / 1048576.0) / stats_seconds(combine) : 0);
+
+  fprintf(out, "  \"syscalls\": {");
+  for (indx = 0; indx < call_count; indx++) {
+    total += atomic_load(&vke_stats.calls[indx]);
+    fprintf(out, "\"%s\": %lu, ", call_names[indx],
+        (unsigned long) atomic_load(&vke_stats.calls[indx]));
+  }
+  fprintf(out, "\"total\": %lu},\n", (unsigned long) total);
+
+  fprintf(out, "  \"rusage\": {\"user_seconds\": %.6f, \"system_seconds\": %.6f, \"max_rss_kb\": %ld, "
+      "\"major_faults\": %ld, \"minor_faults\": %ld, \"voluntary_switches\": %ld, \"involuntary_switches\": %ld},\n",
+      usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1e6),
+      usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec / 1e6),
+      usage.ru_maxrss, usage.ru_majflt, usage.ru_minflt, usage.ru_nvcsw, usage.ru_nivcsw);
+
+  if (vke_perf.enabled) {
+    fprintf(out, "  \"perf_counters\": ");
+    perf_json(out);
+    fprintf(out, ",\n");
+  }
+
+  fprintf(out, "  \"layers\": [");
+  for (layr = cfg->keys; layr < cfg->keys + cfg->key_length; layr++) {
+    bool is_file = (layr->key != NULL && layr->key->is_file);
+
+    fprintf(out, "%s\n    {\"index\": %u, \"type\": \"%s\", \"name\": ", ((layr == cfg->keys) ? "" : ","),
+        layr->indx, (is_file ? "file" : "text"));
+    if (is_file) {
+      stats_string(out, layr->name);
+    } else {
+      fprintf(out, "null");
+    }
+    fprintf(out, ", \"size\": %lu, \"bytes\": %lu",
+        (unsigned long) ((layr->key != NULL) ? layr->key->size : 0),
+        (unsigned long) atomic_load(&layr->bytes));
+
+    for (indx = 0; indx < phase_count; indx++) {
+      if (indx == phase_init || indx == phase_hash || indx == phase_check
+          || indx == phase_compute) {
+        fprintf(out, ", \"%s\": %.6f", phase_names[indx],
+            stats_seconds(atomic_load(&layr->times[indx])));
+      }
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "%s]\n}\n", ((cfg->key_length > 0) ? "\n  " : ""));
+  fflush(out);
+}
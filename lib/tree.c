@@ -0,0 +1,552 @@
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdio.h>     // printf
+#include <stdlib.h>    // malloc, calloc, free
+#include <string.h>    // strlen, strcmp, strdup, sprintf
+#include <time.h>      // clock_gettime, CLOCK_MONOTONIC, timespec
+#include <pthread.h>   // pthread_create, pthread_join
+#include <stdatomic.h> // atomic_init, atomic_load, atomic_store,
+                       // atomic_fetch_add, atomic_fetch_sub
+#include <dirent.h>    // opendir, readdir, closedir
+#include <sys/stat.h>  // stat, lstat, S_ISDIR, S_ISREG
+
+#include <alias.h>     // task_span, task_files, task_*, bool, true, false
+#include <data.h>      // config, obj, cursor, tree, walker, task, split
+#include <deque.h>     // deque_init, deque_push, deque_pop, deque_steal,
+                       // deque_free
+#include <fileset.h>   // fileset_init, fileset_add, fileset_has, fileset_free
+#include <io.h>        // io_open, io_size, io_direct, io_close
+#include <ring.h>      // ring_wait
+#include <pool.h>      // pool_take, pool_give
+#include <vke.h>       // open_cursors, close_cursors, place_cursor
+#include <batch.h>     // combine_source
+#include <stats.h>     // stats_clock, stats_total
+#include <tree.h>
+
+//------------------------------------------------------------------------------
+// Recursive combine
+//
+// Directories, ranges of large sources and batches of small sources are all
+// tasks.  Every walker owns a deque: tasks it creates go to the bottom of its
+// own deque and are taken back newest first, an idle walker steals the oldest
+// task of another deque.  The walk itself runs as tasks, so it overlaps with
+// the combining, and a few huge sources are spread over all walkers as
+// task_span sized ranges instead of keeping one walker busy to the end.
+//
+// A task is counted as pending from the moment it is pushed until it has run
+// (after any tasks it pushed itself), so no pending tasks and empty deques
+// means the whole tree is done.
+
+/**
+ * Combine every file below the recursive sources with the key set
+ */
+bool combine_tree(config* cfg) {
+  tree job;
+  walker* walkers;
+  struct timespec begin;
+  struct timespec end;
+  size_t indx;
+  bool success = true;
+
+  job.cfg   = cfg;
+  job.count = ((cfg->threads > 0) ? cfg->threads : 1);
+  job.span  = (task_span / cfg->buffer_size) * cfg->buffer_size;
+  if (job.span < cfg->buffer_size) {
+    job.span = cfg->buffer_size;
+  }
+  atomic_init(&job.pending, 0);
+  atomic_init(&job.files, 0);
+  atomic_init(&job.failed, 0);
+  atomic_init(&job.bytes, 0);
+
+  job.queues = (deque*) calloc(job.count, sizeof(deque));
+  walkers    = (walker*) calloc(job.count, sizeof(walker));
+
+  if (!job.queues || !walkers || !fileset_init(&job.seen, 1024)) {
+    printf("Unable to create walkers\n");
+    free(job.queues);
+    free(walkers);
+    return false;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+
+  for (indx = 0; success && indx < job.count; indx++) {
+    walkers[indx].job  = &job;
+    walkers[indx].indx = indx;
+
+    if (!deque_init(&job.queues[indx], 64)
+        || !(walkers[indx].buff = pool_take(&cfg->buffers))) {
+      printf("Unable to create walkers\n");
+      success = false;
+    } else if (!(walkers[indx].cursors = open_cursors(cfg, true))) {
+      success = false;
+    }
+  }
+
+  // Seed the deques round robin with the sources given
+  for (indx = 0; success && indx < cfg->source_length; indx++) {
+    add_path(&job, &walkers[indx % job.count], cfg->sources[indx], true);
+  }
+  for (indx = 0; success && indx < job.count; indx++) {
+    flush_batch(&job, &walkers[indx]);
+  }
+
+  for (indx = 0; success && indx < job.count; indx++) {
+    if (pthread_create(&walkers[indx].thread, NULL, tree_worker,
+        &walkers[indx]) != 0) {
+      printf("Unable to start walker %lu\n", indx);
+    } else {
+      walkers[indx].started = true;
+    }
+  }
+  // Walkers steal from every deque, a single one is enough to finish
+  if (success && !walkers[0].started) {
+    tree_worker(&walkers[0]);
+  }
+
+  for (indx = 0; indx < job.count; indx++) {
+    if (walkers[indx].started) {
+      pthread_join(walkers[indx].thread, NULL);
+    }
+    if (walkers[indx].cursors != NULL) {
+      close_cursors(cfg, walkers[indx].cursors);
+    }
+    if (walkers[indx].buff != NULL) {
+      pool_give(&cfg->buffers, walkers[indx].buff);
+    }
+    deque_free(&job.queues[indx]);
+  }
+  fileset_free(&job.seen);
+  free(job.queues);
+  free(walkers);
+
+  if (success && !cfg->quiet) {
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - begin.tv_sec)
+        + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    double megabytes = atomic_load(&job.bytes) / 1048576.0;
+
+    printf("Combined %lu files (%lu failed), %.1fMB in %.3fsec (%.1fMB/s)\n", atomic_load(&job.files), atomic_load(&job.failed), megabytes, seconds, ((seconds > 0) ? megabytes / seconds : 0));
+  }
+  return (success && atomic_load(&job.failed) == 0);
+}
+
+/**
+ * Recursive scheduler worker thread
+ */
+void* tree_worker(void* data) {
+  walker* self = (walker*) data;
+  tree* job = self->job;
+  task* work;
+  unsigned int spins = 0;
+
+  while (true) {
+    if ((work = next_task(job, self)) != NULL) {
+      run_task(job, self, work);
+      free(work);
+
+      atomic_fetch_sub(&job->pending, 1);
+      spins = 0;
+    } else if (atomic_load(&job->pending) == 0) {
+      break;
+    } else {
+      ring_wait(&spins);
+    }
+  }
+  return NULL;
+}
+
+//------------------------------------------------------------------------------
+// Scheduling
+
+/**
+ * Queue a task on the deque of a walker
+ */
+bool push_task(tree* job, walker* self, task* work) {
+  atomic_fetch_add(&job->pending, 1);
+
+  if (!deque_push(&job->queues[self->indx], work)) {
+    atomic_fetch_sub(&job->pending, 1);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Take the newest task of the walker or steal the oldest of another one
+ */
+task* next_task(tree* job, walker* self) {
+  task* work;
+  size_t indx;
+
+  if ((work = deque_pop(&job->queues[self->indx])) != NULL) {
+    return work;
+  }
+  for (indx = 1; indx < job->count; indx++) {
+    work = deque_steal(&job->queues[(self->indx + indx) % job->count]);
+
+    if (work != NULL) {
+      return work;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Run a task, failed sources are counted in the tree
+ */
+bool run_task(tree* job, walker* self, task* work) {
+  bool success = false;
+
+  switch (work->type) {
+    case task_directory:
+      success = walk_directory(job, self, work->path);
+      free(work->path);
+      break;
+    case task_range:
+      success = combine_part(job, self, work);
+      break;
+    case task_batch:
+      success = combine_small(job, self, work);
+      break;
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+// Walking
+
+/**
+ * Create the tasks for a path
+ * - directories become directory tasks, sources that fit the buffer are
+ *   collected into batches and larger ones are split into ranges
+ * - symbolic links below the sources given are not followed
+ * - a file reached twice (hard links, a source given twice or inside
+ *   another one) is combined once, a second pass would undo the first
+ */
+bool add_path(tree* job, walker* self, const char* path, bool follow) {
+  struct stat info;
+  task* work;
+
+  if ((follow ? stat(path, &info) : lstat(path, &info)) != 0) {
+    printf("Unable to open %s\n", path);
+    atomic_fetch_add(&job->failed, 1);
+    return false;
+  }
+
+  if ((S_ISDIR(info.st_mode) || S_ISREG(info.st_mode))
+      && !first_visit(job, path, &info, follow)) {
+    return true;
+  }
+
+  if (S_ISDIR(info.st_mode)) {
+    if (!(work = (task*) calloc(1, sizeof(task)))
+        || !(work->path = strdup(path))) {
+      printf("Unable to queue %s\n", path);
+      atomic_fetch_add(&job->failed, 1);
+      free(work);
+      return false;
+    }
+    work->type = task_directory;
+
+    if (!push_task(job, self, work)) {
+      printf("Unable to queue %s\n", path);
+      atomic_fetch_add(&job->failed, 1);
+      free(work->path);
+      free(work);
+      return false;
+    }
+  } else if (!S_ISREG(info.st_mode)) {
+    if (!job->cfg->quiet) {
+      printf("Skipping %s (not a regular file or directory)\n", path);
+    }
+  } else if ((size_t) info.st_size > job->cfg->buffer_size) {
+    stats_total(info.st_size);
+    return add_split(job, self, path);
+  } else {
+    stats_total(info.st_size);
+
+    if (self->small == NULL
+        && !(self->small = (task*) calloc(1, sizeof(task)))) {
+      printf("Unable to queue %s\n", path);
+      atomic_fetch_add(&job->failed, 1);
+      return false;
+    }
+    self->small->type = task_batch;
+
+    if (!(self->small->names[self->small->count] = strdup(path))) {
+      printf("Unable to queue %s\n", path);
+      atomic_fetch_add(&job->failed, 1);
+      return false;
+    }
+    self->small->count++;
+
+    if (self->small->count == task_files) {
+      return flush_batch(job, self);
+    }
+  }
+  return true;
+}
+
+/**
+ * Record a directory or file of the walk, false if it was reached before
+ * (or cannot be recorded)
+ * - sources given and directories are always recorded, files below them
+ *   only with more than one link, a file with a single link can still be
+ *   one of the sources given
+ */
+bool first_visit(tree* job, const char* path, struct stat* info, bool follow) {
+  bool added = true;
+
+  if (follow || S_ISDIR(info->st_mode) || info->st_nlink > 1) {
+    if (!fileset_add(&job->seen, info, &added)) {
+      printf("Unable to queue %s\n", path);
+      atomic_fetch_add(&job->failed, 1);
+      return false;
+    }
+  } else {
+    added = !fileset_has(&job->seen, info);
+  }
+
+  if (!added && !job->cfg->quiet) {
+    printf("Skipping %s (reached before through another path)\n", path);
+  }
+  return added;
+}
+
+/**
+ * Open a large source and queue one range task per task span
+ */
+bool add_split(tree* job, walker* self, const char* path) {
+  split* part;
+  task* work;
+  size_t ranges;
+  size_t indx;
+
+  if (!(part = (split*) calloc(1, sizeof(split)))
+      || !(part->src.name = strdup(path))) {
+    printf("Unable to queue %s\n", path);
+    atomic_fetch_add(&job->failed, 1);
+    free(part);
+    return false;
+  }
+  part->src.is_file = true;
+  part->src.out     = &part->src.io;
+
+  if (!io_open(&part->src.io, path, !job->cfg->dry_run)
+      || !io_size(&part->src.io, &part->src.size)) {
+    printf("Unable to open %s\n", path);
+    atomic_fetch_add(&job->failed, 1);
+    io_close(&part->src.io);
+    free(part->src.name);
+    free(part);
+    return false;
+  }
+  if (job->cfg->direct) {
+    io_direct(&part->src.io);
+  }
+
+  ranges = ((part->src.size + job->span - 1) / job->span);
+  atomic_init(&part->pending, ranges);
+  atomic_init(&part->failed, false);
+
+  for (indx = 0; indx < ranges; indx++) {
+    if (!(work = (task*) calloc(1, sizeof(task)))) {
+      break;
+    }
+    work->type  = task_range;
+    work->part  = part;
+    work->start = indx * job->span;
+    work->end   = work->start + job->span;
+    if (work->end > part->src.size) {
+      work->end = part->src.size;
+    }
+
+    if (!push_task(job, self, work)) {
+      free(work);
+      break;
+    }
+  }
+
+  if (indx < ranges) {
+    printf("Unable to queue %s\n", path);
+
+    for (; indx < ranges; indx++) {
+      finish_split(job, part, false);
+    }
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Queue the small sources a walker has collected
+ */
+bool flush_batch(tree* job, walker* self) {
+  task* work = self->small;
+  size_t indx;
+
+  if (work == NULL) {
+    return true;
+  }
+  self->small = NULL;
+
+  if (!push_task(job, self, work)) {
+    for (indx = 0; indx < work->count; indx++) {
+      printf("Unable to queue %s\n", work->names[indx]);
+      free(work->names[indx]);
+    }
+    atomic_fetch_add(&job->failed, work->count);
+    free(work);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Walk one directory level, subdirectories are queued as tasks of their own
+ */
+bool walk_directory(tree* job, walker* self, const char* path) {
+  DIR* dir;
+  struct dirent* entry;
+  size_t length = strlen(path);
+  char* child;
+  bool success = true;
+
+  if (!(dir = opendir(path))) {
+    printf("Unable to open %s\n", path);
+    atomic_fetch_add(&job->failed, 1);
+    return false;
+  }
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    if (!(child = (char*) malloc(length + strlen(entry->d_name) + 2))) {
+      printf("Unable to queue %s/%s\n", path, entry->d_name);
+      atomic_fetch_add(&job->failed, 1);
+      success = false;
+      continue;
+    }
+    if (length > 0 && path[length - 1] == '/') {
+      sprintf(child, "%s%s", path, entry->d_name);
+    } else {
+      sprintf(child, "%s/%s", path, entry->d_name);
+    }
+
+    if (!add_path(job, self, child, false)) {
+      success = false;
+    }
+    free(child);
+  }
+  closedir(dir);
+
+  if (!flush_batch(job, self)) {
+    success = false;
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+// Combining
+
+/**
+ * Combine one range of a split source
+ */
+bool combine_part(tree* job, walker* self, task* work) {
+  config* cfg = job->cfg;
+  split* part = work->part;
+  size_t indx;
+  bool success = !atomic_load(&part->failed);
+
+  if (!cfg->quiet && work->start == 0) {
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
+    printf("Combining source %s (%dsec & %dms)\n", part->src.name, msec / 1000, msec % 1000);
+  }
+
+  for (indx = 0; success && indx < cfg->key_length; indx++) {
+    success = place_cursor(&self->cursors[indx], part->src.size, work->start);
+  }
+  if (success) {
+    success = combine_source(cfg, &part->src, self->cursors, self->buff,
+        work->start, work->end);
+  }
+  if (success) {
+    atomic_fetch_add(&job->bytes, work->end - work->start);
+  }
+  finish_split(job, part, success);
+  return success;
+}
+
+/**
+ * Combine a batch of small sources, each with one read and one write
+ */
+bool combine_small(tree* job, walker* self, task* work) {
+  config* cfg = job->cfg;
+  obj src;
+  size_t next;
+  size_t indx;
+  bool success = true;
+  bool done;
+
+  for (next = 0; next < work->count; next++) {
+    src.name        = work->names[next];
+    src.initialized = false;
+    src.is_file     = true;
+    src.out         = &src.io;
+    src.buff        = self->buff;
+    src.indx        = 0;
+
+    if (!cfg->quiet) {
+      int msec = (int)((stats_clock() - cfg->start) / 1000000);
+      printf("Combining source %s (%dsec & %dms)\n", src.name, msec / 1000, msec % 1000);
+    }
+
+    done = io_open(&src.io, src.name, !cfg->dry_run);
+    if (!done) {
+      printf("Unable to open %s\n", src.name);
+    } else if (!(done = io_size(&src.io, &src.size))) {
+      printf("Unable to read from %s\n", src.name);
+    }
+    for (indx = 0; done && indx < cfg->key_length; indx++) {
+      done = place_cursor(&self->cursors[indx], src.size, 0);
+    }
+    if (done) {
+      done = combine_source(cfg, &src, self->cursors, self->buff, 0, src.size);
+    }
+    io_close(&src.io);
+
+    if (done) {
+      atomic_fetch_add(&job->files, 1);
+      atomic_fetch_add(&job->bytes, src.size);
+    } else {
+      atomic_fetch_add(&job->failed, 1);
+      success = false;
+    }
+    free(work->names[next]);
+  }
+  return success;
+}
+
+/**
+ * Count a finished range of a split source, the last one closes it
+ */
+void finish_split(tree* job, split* part, bool success) {
+  if (!success) {
+    atomic_store(&part->failed, true);
+  }
+  if (atomic_fetch_sub(&part->pending, 1) == 1) {
+    io_close(&part->src.io);
+
+    if (atomic_load(&part->failed)) {
+      atomic_fetch_add(&job->failed, 1);
+    } else {
+      atomic_fetch_add(&job->files, 1);
+    }
+    free(part->src.name);
+    free(part);
+  }
+}
@@ -0,0 +1,284 @@
+
+//------------------------------------------------------------------------------
+// Dependencies
+
+#include <stdint.h>      // UINT32_MAX
+#include <string.h>      // memset
+#include <unistd.h>      // close, syscall
+#include <stdatomic.h>   // atomic_thread_fence
+#include <sys/mman.h>    // mmap, munmap
+#include <sys/syscall.h> // __NR_io_uring_setup, __NR_io_uring_enter,
+                         // __NR_io_uring_register
+
+#include <alias.h>       // phase_uring, call_uring, bool, true, false
+#include <stats.h>       // stats_begin, stats_phase, stats_call
+#include <uring.h>
+
+#ifdef VKE_URING
+
+//------------------------------------------------------------------------------
+// Initialization
+
+/**
+ * Set up a ring with room for entries submissions
+ * - fails (so callers can fall back to plain I/O) when the kernel has no
+ *   io_uring support or it is blocked by policy
+ */
+bool uring_init(uring* rng, unsigned int entries, bool sqpoll) {
+  struct io_uring_params params;
+  char* sq;
+  char* cq;
+
+  memset(rng, 0, sizeof(uring));
+  memset(&params, 0, sizeof(params));
+
+  if (sqpoll) {
+    params.flags          = IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = 1000;
+  }
+  if ((rng->fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    return false;
+  }
+  rng->entries = params.sq_entries;
+  rng->flags   = params.flags;
+
+  rng->sq_length = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  rng->cq_length = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (rng->cq_length > rng->sq_length) {
+      rng->sq_length = rng->cq_length;
+    }
+    rng->cq_length = rng->sq_length;
+  }
+
+  rng->sq_ptr = mmap(NULL, rng->sq_length, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, rng->fd, IORING_OFF_SQ_RING);
+
+  if (rng->sq_ptr == MAP_FAILED) {
+    close(rng->fd);
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    rng->cq_ptr = rng->sq_ptr;
+  } else {
+    rng->cq_ptr = mmap(NULL, rng->cq_length, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, rng->fd, IORING_OFF_CQ_RING);
+
+    if (rng->cq_ptr == MAP_FAILED) {
+      munmap(rng->sq_ptr, rng->sq_length);
+      close(rng->fd);
+      return false;
+    }
+  }
+
+  rng->sqes_length = params.sq_entries * sizeof(struct io_uring_sqe);
+  rng->sqes = mmap(NULL, rng->sqes_length, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, rng->fd, IORING_OFF_SQES);
+
+  if (rng->sqes == MAP_FAILED) {
+    if (rng->cq_ptr != rng->sq_ptr) {
+      munmap(rng->cq_ptr, rng->cq_length);
+    }
+    munmap(rng->sq_ptr, rng->sq_length);
+    close(rng->fd);
+    return false;
+  }
+
+  sq = (char*) rng->sq_ptr;
+  cq = (char*) rng->cq_ptr;
+
+  rng->sq_head  = (unsigned int*)(sq + params.sq_off.head);
+  rng->sq_tail  = (unsigned int*)(sq + params.sq_off.tail);
+  rng->sq_mask  = (unsigned int*)(sq + params.sq_off.ring_mask);
+  rng->sq_flags = (unsigned int*)(sq + params.sq_off.flags);
+  rng->sq_array = (unsigned int*)(sq + params.sq_off.array);
+
+  rng->cq_head = (unsigned int*)(cq + params.cq_off.head);
+  rng->cq_tail = (unsigned int*)(cq + params.cq_off.tail);
+  rng->cq_mask = (unsigned int*)(cq + params.cq_off.ring_mask);
+  rng->cqes    = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+  return true;
+}
+
+/**
+ * Tear down a ring (registered buffers and files go with it)
+ */
+void uring_exit(uring* rng) {
+  munmap(rng->sqes, rng->sqes_length);
+
+  if (rng->cq_ptr != rng->sq_ptr) {
+    munmap(rng->cq_ptr, rng->cq_length);
+  }
+  munmap(rng->sq_ptr, rng->sq_length);
+  close(rng->fd);
+}
+
+/**
+ * Pin I/O buffers in the kernel so fixed reads and writes skip the
+ * per request page mapping
+ */
+bool uring_register_buffers(uring* rng, struct iovec* buffers,
+    unsigned int count) {
+  return (syscall(__NR_io_uring_register, rng->fd, IORING_REGISTER_BUFFERS,
+      buffers, count) == 0);
+}
+
+/**
+ * Register the file all requests go to (fixed file slot 0)
+ */
+bool uring_register_file(uring* rng, int fd) {
+  return (syscall(__NR_io_uring_register, rng->fd, IORING_REGISTER_FILES,
+      &fd, 1) == 0);
+}
+
+//------------------------------------------------------------------------------
+// Submission
+
+/**
+ * Queue a fixed buffer request against registered file 0
+ * - submission lengths are 32 bit, a longer request is refused rather than
+ *   cut short
+ */
+static bool uring_queue(uring* rng, unsigned char opcode, unsigned int buffer,
+    const char* buff, size_t length, size_t offset, unsigned long long data) {
+  unsigned int tail = *rng->sq_tail;
+  unsigned int head = atomic_load_explicit((_Atomic unsigned int*) rng->sq_head,
+      memory_order_acquire);
+  unsigned int indx;
+  struct io_uring_sqe* sqe;
+
+  if ((tail - head) >= rng->entries || length > UINT32_MAX) {
+    return false;
+  }
+  indx = tail & *rng->sq_mask;
+  sqe  = &rng->sqes[indx];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode    = opcode;
+  sqe->flags     = IOSQE_FIXED_FILE;
+  sqe->fd        = 0;
+  sqe->addr      = (unsigned long long)(size_t) buff;
+  sqe->len       = length;
+  sqe->off       = offset;
+  sqe->buf_index = buffer;
+  sqe->user_data = data;
+
+  rng->sq_array[indx] = indx;
+  atomic_store_explicit((_Atomic unsigned int*) rng->sq_tail, tail + 1,
+      memory_order_release);
+  rng->pending++;
+  return true;
+}
+
+bool uring_read(uring* rng, unsigned int buffer, char* buff, size_t length,
+    size_t offset, unsigned long long data) {
+  return uring_queue(rng, IORING_OP_READ_FIXED, buffer, buff, length, offset,
+      data);
+}
+
+bool uring_write(uring* rng, unsigned int buffer, const char* buff,
+    size_t length, size_t offset, unsigned long long data) {
+  return uring_queue(rng, IORING_OP_WRITE_FIXED, buffer, buff, length, offset,
+      data);
+}
+
+/**
+ * Submit every queued request in one call, optionally waiting for wait
+ * completions
+ * - with SQPOLL the kernel thread picks requests up by itself and only
+ *   needs a wakeup once it went idle
+ */
+bool uring_submit(uring* rng, unsigned int wait) {
+  unsigned int flags  = 0;
+  unsigned int submit = rng->pending;
+  uint64_t begin;
+  bool success;
+
+  if (rng->flags & IORING_SETUP_SQPOLL) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit((_Atomic unsigned int*) rng->sq_flags,
+        memory_order_relaxed) & IORING_SQ_NEED_WAKEUP) {
+      flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    submit = 0;
+  }
+  if (wait > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+  }
+  rng->pending = 0;
+
+  if (submit == 0 && flags == 0) {
+    return true;
+  }
+  begin   = stats_begin();
+  success = (syscall(__NR_io_uring_enter, rng->fd, submit, wait, flags, NULL, 0) >= 0);
+
+  stats_call(call_uring);
+  stats_phase(phase_uring, begin);
+  return success;
+}
+
+/**
+ * Pop one completion, false if none is ready
+ */
+bool uring_complete(uring* rng, unsigned long long* data, int* result) {
+  unsigned int head = *rng->cq_head;
+  struct io_uring_cqe* cqe;
+
+  if (head == atomic_load_explicit((_Atomic unsigned int*) rng->cq_tail,
+      memory_order_acquire)) {
+    return false;
+  }
+  cqe = &rng->cqes[head & *rng->cq_mask];
+
+  *data   = cqe->user_data;
+  *result = cqe->res;
+
+  atomic_store_explicit((_Atomic unsigned int*) rng->cq_head, head + 1,
+      memory_order_release);
+  return true;
+}
+
+#else
+
+//------------------------------------------------------------------------------
+// Unsupported platform (callers fall back to plain I/O)
+
+bool uring_init(uring* rng, unsigned int entries, bool sqpoll) {
+  rng->fd = -1;
+  return false;
+}
+
+void uring_exit(uring* rng) {
+}
+
+bool uring_register_buffers(uring* rng, struct iovec* buffers,
+    unsigned int count) {
+  return false;
+}
+
+bool uring_register_file(uring* rng, int fd) {
+  return false;
+}
+
+bool uring_read(uring* rng, unsigned int buffer, char* buff, size_t length,
+    size_t offset, unsigned long long data) {
+  return false;
+}
+
+bool uring_write(uring* rng, unsigned int buffer, const char* buff,
+    size_t length, size_t offset, unsigned long long data) {
+  return false;
+}
+
+bool uring_submit(uring* rng, unsigned int wait) {
+  return false;
+}
+
+bool uring_complete(uring* rng, unsigned long long* data, int* result) {
+  return false;
+}
+
+#endif
@@ -2,50 +2,132 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <string.h>  // strlen
+#include <string.h>  // memcpy, memset
+#include <sys/mman.h> // mmap, madvise, munmap
 
 #include <data.h>    // obj
-#include <alias.h>   // bool, true, false
+#include <alias.h>   // key_block, huge_page, call_map, bool, true, false
+#include <kernel.h>  // sanitize_bytes, sanitize_bytes_generic
+#include <stats.h>   // stats_call
 
 //------------------------------------------------------------------------------
-// String utilities
+// Encryption related utilities
+
+/**
+ * Repeat the material of a text key up to key_block - 1 bytes into buff
+ * (key_block bytes, NUL terminated) and return the filled length
+ * - a NULL buff only returns the length
+ */
+size_t fill_key_buffer(const obj* key, char* buff) {
+  size_t size = key->length;
+  size_t done;
+  size_t count;
+
+  if (size > 0 && size < (key_block - 1)) {
+    size = key_block - 1;
+  }
+  if (buff == NULL) {
+    return size;
+  }
 
-char* reverse_string(char* str) {
-  char tmp, *src, *dst;
-  size_t len;
+  memcpy(buff, key->buff, key->length);
 
-  if (str != NULL) {
-    len = strlen(str);
+  for (done = key->length; done < size; done += count) {
+    count = ((done < size - done) ? done : size - done);
+    memcpy(buff + done, buff, count);
+  }
+  buff[size] = '\0';
+  return size;
+}
+
+/**
+ * Sanitize a text key buffer passes times without walking every pass
+ * - each byte only ever depends on its own previous value, so its orbit
+ *   through the 256 possible values is followed until it cycles and the
+ *   remaining passes are skipped modulo the cycle length
+ * - no orbit is longer than 256 steps, up to that many passes are cheaper
+ *   as whole vectorized passes
+ */
+void advance_key_buffer(char* buff, int key_read, size_t passes) {
+  size_t first[256];
+  size_t mark[256];
+  size_t step;
+  int indx;
+  char value;
+
+  if (passes <= 256) {
+    for (step = 0; step < passes; step++) {
+      sanitize_bytes(buff, 0, key_read, key_read);
+    }
+    return;
+  }
+  memset(mark, 0, sizeof(mark));
 
-    if (len > 1) {
-      src = str;
-      dst = src + len - 1;
+  for (indx = 0; indx < key_read; indx++) {
+    value = buff[indx];
 
-      while (src < dst) {
-        tmp    = *src;
-        *src++ = *dst;
-        *dst-- = tmp;
+    for (step = 0; step < passes; step++) {
+      if (mark[(unsigned char)value] == (size_t)(indx + 1)) {
+        step = passes - ((passes - step) % (step - first[(unsigned char)value]));
+        break;
       }
+      mark[(unsigned char)value]  = indx + 1;
+      first[(unsigned char)value] = step;
+
+      sanitize_bytes_generic(&value, indx, 1, key_read);
+    }
+    for (; step < passes; step++) {
+      sanitize_bytes_generic(&value, indx, 1, key_read);
     }
+    buff[indx] = value;
   }
-  return str;
 }
 
 //------------------------------------------------------------------------------
-// Encryption related utilities
+// I/O buffers
+
+/**
+ * Allocate a page aligned I/O buffer
+ * - buffers of at least one huge page come from explicit huge pages when
+ *   the system has them reserved and otherwise ask for transparent ones
+ */
+char* alloc_buffer(size_t size) {
+  size_t length = size;
+  void* buff = MAP_FAILED;
 
-bool fill_key_buffer(obj* key) {
-  if (!key->is_file) {
-    size_t key_buff_indx = strlen(key->buff);
-    size_t select_indx   = 0;
+  if (size >= huge_page) {
+    length = ((size + huge_page - 1) / huge_page) * huge_page;
+#ifdef MAP_HUGETLB
+    buff = mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    stats_call(call_map);
+#endif
+  }
+  if (buff == MAP_FAILED) {
+    buff = mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    stats_call(call_map);
 
-    while (key_buff_indx < (buff_size - 1)) {
-      key->buff[key_buff_indx] = key->buff[select_indx];
-      key->buff[(key_buff_indx + 1)] = '\0';
-      key_buff_indx++;
-      select_indx++;
+    if (buff == MAP_FAILED) {
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    if (size >= huge_page) {
+      madvise(buff, length, MADV_HUGEPAGE);
+      stats_call(call_map);
     }
-    key->size = strlen(key->buff);
+#endif
+  }
+  return (char*) buff;
+}
+
+/**
+ * Release a buffer from alloc_buffer (size as allocated)
+ */
+void free_buffer(char* buff, size_t size) {
+  if (size >= huge_page) {
+    size = ((size + huge_page - 1) / huge_page) * huge_page;
   }
-  return true;
+  munmap(buff, size);
+  stats_call(call_map);
 }
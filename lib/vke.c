@@ -2,16 +2,36 @@
 //------------------------------------------------------------------------------
 // Dependencies
 
-#include <stdio.h>   // FILE, stderr, sprintf, printf, fopen
-#include <stdlib.h>  // calloc, free
-#include <string.h>  // strlen, strcpy
-#include <unistd.h>  // getpass
-#include <time.h>    // CLOCKS_PER_SEC, clock_t, clock
-
-#include <alias.h>   // buff_size, bool, true, false
-#include <data.h>    // config, obj, layer
-#include <hash.h>    // get_hash
-#include <utility.h> // reverse_string, fill_key_buffer
+#include <stdio.h>     // sprintf, printf, rename
+#include <stdlib.h>    // calloc, free, realpath
+#include <string.h>    // strlen, strcpy, memcpy
+#include <unistd.h>    // getpass, unlink, sysconf, STDIN_FILENO
+#include <sys/stat.h>  // stat, lstat, fstat, fchmod, umask, S_IS*
+#include <pthread.h>   // pthread_create, pthread_join
+#include <stdatomic.h> // atomic_init, atomic_load, atomic_store,
+                       // atomic_fetch_add
+#include <sys/mman.h>  // mmap, madvise, munmap
+
+#include <alias.h>     // key_block, key_material, key_share, key_group,
+                       // map_size, page_align, queue_depth, pipe_size,
+                       // chunk_*, phase_*, call_*, perf_*, bool, true, false
+#include <data.h>      // config, obj, layer, keyset, cursor, worker, chunk,
+                       // pipeline
+#include <hash.h>      // derive_keys
+#include <io.h>        // io_open, io_attach, io_read, io_read_at, io_write_at,
+                       // io_size, io_direct, io_pipe_size, io_temp,
+                       // io_truncate, io_sync, io_sync_parent, io_close
+#include <kernel.h>    // xor_buffer, sanitize_bytes
+#include <perf.h>      // perf_begin, perf_stage
+#include <pool.h>      // arena_alloc, pool_take, pool_give
+#include <probe.h>     // probe2
+#include <ring.h>      // ring_init, ring_push, ring_pop, ring_wait, ring_free
+#include <stats.h>     // stats_clock, stats_begin, stats_since, stats_layer,
+                       // stats_call, stats_bytes, stats_combined
+#include <uring.h>     // uring_init, uring_read, uring_write, uring_submit,
+                       // uring_complete, uring_exit
+#include <utility.h>   // fill_key_buffer, advance_key_buffer,
+                       // alloc_buffer, free_buffer
 #include <vke.h>
 
 //------------------------------------------------------------------------------
@@ -19,41 +39,45 @@
 
 /**
  * Initialize a source file and encryption keys
+ * - sources take a buffer from the pool, text keys keep their material in
+ *   the arena
+ * - text shorter than the hash threshold is derived by the caller
+ *   (initialize_group), until then the material is the text
  */
 bool initialize(config* cfg, obj* info, char* name, int indx,
-    const char* access, bool force_file) {
+    bool writable, bool force_file) {
+  char* text = name;
+
   info->name        = name;
   info->initialized = false;
   info->is_file     = true;
-  info->hash        = NULL;
-  info->rev_str     = NULL;
-  info->rev_hash    = NULL;
-  info->final_hash  = NULL;
+  info->out         = &info->io;
+  info->buff        = NULL;
+  info->passes      = 0;
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
     printf("Initializing: %s [ %u ] (%dsec & %dms)\n", name, indx, msec / 1000, msec % 1000);
   }
 
-  if (!(info->buff = (char*) calloc(buff_size, 1))) {
+  if (force_file && !(info->buff = pool_take(&cfg->buffers))) {
     printf("Unable to buffer %s\n", info->name);
     return false;
   }
-  if (!(info->data = fopen(info->name, access))) {
+  if (!io_open(&info->io, info->name, writable)) {
     if (force_file) {
       printf("Unable to open %s\n", info->name);
-      free(info->buff);
+      pool_give(&cfg->buffers, info->buff);
+      info->buff = NULL;
       return false;
     } else {
+      char pass_input[1000];
+
       info->indx = 0;
       info->is_file = false;
 
-      strcpy(info->buff, "");
-      strcpy(info->buff, name);
-
-      if (strcmp(info->buff, "prompt") == 0) {
+      if (strcmp(text, "prompt") == 0) {
         char pass_prompt[80];
-        char pass_input[1000];
         char confirm_prompt[80];
         char confirm_input[1000];
         char* input_buffer;
@@ -67,8 +91,7 @@ bool initialize(config* cfg, obj* info, char* name, int indx,
         strcpy(confirm_input, input_buffer);
 
         if (strcmp(pass_input, confirm_input) == 0) {
-          strcpy(info->buff, "");
-          strcpy(info->buff, pass_input);
+          text = pass_input;
           free(input_buffer);
         } else {
           printf("Passphrase and confirmation for key %u do not match\n\n",
@@ -78,185 +101,1458 @@ bool initialize(config* cfg, obj* info, char* name, int indx,
         }
       }
 
-      info->size = strlen(info->buff);
+      info->length = strlen(text);
+
+      // A key stream chunk holds at most key_block - 1 bytes of text
+      if (info->length >= key_block) {
+        printf("Unable to buffer %s\n", info->name);
+        return false;
+      }
+      if (text == name && info->length < cfg->hash_threshold) {
+        // The name belongs to the arena as well
+        info->buff = name;
+      } else if (!(info->buff = (char*) arena_alloc(&cfg->memory, info->length + 1))) {
+        printf("Unable to buffer %s\n", info->name);
+        return false;
+      } else {
+        memcpy(info->buff, text, info->length + 1);
+      }
+      info->size = info->length;
+    }
+  } else {
+    if (!io_size(&info->io, &info->size)) {
+      printf("Unable to read from %s\n", info->name);
+      io_close(&info->io);
+      if (info->buff != NULL) {
+        pool_give(&cfg->buffers, info->buff);
+        info->buff = NULL;
+      }
+      return false;
+    }
+    if (force_file && cfg->direct && !io_direct(&info->io) && !cfg->quiet) {
+      printf("Direct I/O is unavailable, using cached I/O for %s\n", info->name);
+    }
+    info->indx = 0;
+  }
+  info->initialized = true;
+  return true;
+}
+
+/**
+ * Initialize every key layer, returns the number of keys that failed
+ * - prompts are read first, one after another, then key files are opened
+ *   and text keys derived by up to one thread per CPU (key_share keys or
+ *   more each), every thread taking the next key_group keys
+ */
+size_t initialize_keys(config* cfg) {
+  keyset job;
+  pthread_t* threads = NULL;
+  obj* keys;
+  long cores   = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t count = cfg->key_length / key_share;
+  size_t started;
+  size_t indx;
+
+  if (!(keys = (obj*) arena_alloc(&cfg->memory, cfg->key_length * sizeof(obj)))) {
+    printf("Unable to create key objects\n");
+    return cfg->key_length;
+  }
+  memset(keys, 0, cfg->key_length * sizeof(obj));
 
-      if (info->size < cfg->hash_threshold) {
-        info->hash    = get_hash(info->buff);
-        info->rev_str = (char*)malloc((strlen(info->buff) + 1) * sizeof(char));
-        strcpy(info->rev_str, info->buff);
+  job.cfg = cfg;
+  atomic_init(&job.next, 0);
+  atomic_init(&job.failed, 0);
 
-        info->rev_str  = reverse_string(info->rev_str);
-        info->rev_hash = get_hash(info->rev_str);
+  for (indx = 0; indx < cfg->key_length; indx++) {
+    layer* temp = &cfg->keys[indx];
 
-        info->final_hash = (char*)malloc((strlen(info->hash) + strlen(info->rev_hash) + 1) * sizeof(char));
-        info->final_hash[0] = '\0';
+    temp->key        = &keys[indx];
+    keys[indx].io.fd = -1;
 
-        strcat(info->final_hash, info->hash);
-        strcat(info->final_hash, info->rev_hash);
-        strcpy(info->buff, info->final_hash);
+    if (strcmp(temp->name, "prompt") == 0) {
+      atomic_fetch_add(&job.failed, initialize_group(cfg, &temp, 1));
+    }
+  }
 
-        info->size = strlen(info->buff);
+  if (cores > 0 && count > (size_t) cores) {
+    count = cores;
+  }
+  // The calling thread is one of them
+  if (count > 1) {
+    threads = (pthread_t*) calloc(count - 1, sizeof(pthread_t));
+  }
+  for (started = 0; threads && started < count - 1; started++) {
+    if (pthread_create(&threads[started], NULL, key_worker, &job) != 0) {
+      break;
+    }
+  }
+  key_worker(&job);
+
+  for (indx = 0; indx < started; indx++) {
+    pthread_join(threads[indx], NULL);
+  }
+  free(threads);
+  return atomic_load(&job.failed);
+}
+
+/**
+ * Key initialization thread
+ */
+void* key_worker(void* data) {
+  keyset* job = (keyset*) data;
+  config* cfg = job->cfg;
+  layer* group[key_group];
+  size_t count;
+  size_t next;
+  size_t end;
+
+  while ((next = atomic_fetch_add(&job->next, key_group)) < cfg->key_length) {
+    end = ((next + key_group < cfg->key_length) ? next + key_group : cfg->key_length);
+
+    for (count = 0; next < end; next++) {
+      if (strcmp(cfg->keys[next].name, "prompt") != 0) {
+        group[count++] = &cfg->keys[next];
       }
     }
-  } else {
-    fseek(info->data, 0, SEEK_END);
-    info->size = ftell(info->data);
+    atomic_fetch_add(&job->failed, initialize_group(cfg, group, count));
+  }
+  return NULL;
+}
 
-    fseek(info->data, 0, SEEK_SET);
-    info->indx = 0;
+/**
+ * Initialize the keys of up to key_group layers, timed for --stats and
+ * --perf_counters, returns the number of keys that failed
+ * - short text keys are derived together, so their sponges run side by
+ *   side (derive_keys) and each is charged an equal share of the time
+ */
+size_t initialize_group(config* cfg, layer** group, size_t count) {
+  char material[key_group][key_material];
+  const char* texts[key_group];
+  size_t lengths[key_group];
+  char* materials[key_group];
+  size_t sizes[key_group];
+  layer* derived[key_group];
+  size_t failed  = 0;
+  size_t bytes   = 0;
+  size_t pending = 0;
+  uint64_t begin;
+  uint64_t spent;
+  perf_sample sample;
+  size_t indx;
+  obj* key;
+
+  for (indx = 0; indx < count; indx++) {
+    key   = group[indx]->key;
+    begin = stats_begin();
+    perf_begin(&sample);
+
+    if (!initialize(cfg, key, group[indx]->name, group[indx]->indx, false, false)) {
+      failed++;
+      continue;
+    }
+    perf_stage(perf_key_init, &sample, key->size);
+    stats_layer(group[indx], phase_init, stats_since(begin));
+
+    if (!key->is_file && key->length < cfg->hash_threshold) {
+      texts[pending]     = key->buff;
+      lengths[pending]   = key->length;
+      materials[pending] = material[pending];
+      derived[pending++] = group[indx];
+      bytes += key->length * 2;
+    }
   }
-  info->initialized = true;
-  return true;
+  if (pending == 0) {
+    return failed;
+  }
+
+  begin = stats_begin();
+  perf_begin(&sample);
+  derive_keys(texts, lengths, materials, sizes, pending);
+  perf_stage(perf_hash, &sample, bytes);
+  spent = stats_since(begin);
+
+  for (indx = 0; indx < pending; indx++) {
+    key = derived[indx]->key;
+    stats_layer(derived[indx], phase_hash, spent / pending);
+
+    if (!(key->buff = (char*) arena_alloc(&cfg->memory, sizes[indx] + 1))) {
+      printf("Unable to buffer %s\n", key->name);
+      key->initialized = false;
+      failed++;
+      continue;
+    }
+    memcpy(key->buff, material[indx], sizes[indx] + 1);
+    key->length = sizes[indx];
+    key->size   = sizes[indx];
+  }
+  return failed;
 }
 
 //------------------------------------------------------------------------------
 // Checks and verification
 
 /**
- * Run sanity checks on the source file and encryption keys
+ * Make sure the source can be read and (unless dry running or writing
+ * elsewhere) written
  */
-bool check(config* cfg, obj* src, obj* key) {
-  int src_read;
-  int key_read;
+bool check_source(config* cfg, obj* src) {
+  char probe;
 
-  int indx;
+  if (src->size > 0) {
+    if (!io_read_at(&src->io, &probe, 1, 0)) {
+      printf("Unable to read from %s\n", src->name);
+      return false;
+    }
+    if (!cfg->dry_run && !cfg->output && !io_write_at(&src->io, &probe, 1, 0)) {
+      printf("Unable to write %s\n", src->name);
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Run sanity checks on an encryption key
+ * - only the key is probed, the source is never read in full
+ * - text keys are marked to start where a full verification pass would
+ *   have left them, so the key stream stays the same
+ */
+bool check(config* cfg, obj* src, obj* key) {
+  char probe;
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
     printf("Verifying success of key %s [ %lu ] (%dsec & %dms)\n", key->name, key->size, msec / 1000, msec % 1000);
   }
 
-  fseek(src->data, 0, SEEK_SET);
-  src->indx = 0;
+  if (cfg->keystream == 1 && !key->is_file) {
+    key->size = fill_key_buffer(key, NULL);
+  }
+  if (key->size < 1) {
+    printf("Unable to read from %s\n", key->name);
+    return false;
+  }
 
-  if (fill_key_buffer(key)) {
-    while (src->indx < src->size) {
-      if ((src_read = fread(src->buff, 1, buff_size, src->data)) < 1) {
-        printf("Unable to read from %s\n", src->name);
-        return false;
-      }
-      if (key->is_file) {
-        if ((key_read = fread(key->buff, 1, buff_size, key->data)) < buff_size) {
-          if (key_read < 1) {
-            printf("Unable to read from %s\n", key->name);
-            return false;
-          }
-          fseek(key->data, 0, SEEK_SET);
-          key->indx = 0;
-        }
-      } else {
-        key_read = key->size;
-      }
+  if (key->is_file) {
+    if (!io_read_at(&key->io, &probe, 1, 0)) {
+      printf("Unable to read from %s\n", key->name);
+      return false;
+    }
 
-      sanitize_buffer(key, key_read);
+    // A version 1 key that is an exact multiple of the key block never
+    // wraps around
+    if (cfg->keystream == 1 && (key->size % key_block) == 0
+        && src->size > key->size) {
+      printf("Unable to read from %s\n", key->name);
+      return false;
+    }
+  } else if (cfg->keystream == 1 && !cfg->deep_check && src->size > 0) {
+    key->passes = ((src->size - 1) / key->size) + 1;
+  }
+  return true;
+}
 
-      indx = 0;
-      while ((indx < src_read) && (indx < key_read)) {
-        src->buff[indx] = src->buff[indx] ^ key->buff[indx];
-        indx++;
-        src->indx++;
-        key->indx++;
-      }
+/**
+ * Run every key over the whole source without writing anything
+ * - with more than one thread the source is split into ranges like the
+ *   parallel combine, every worker runs all keys over its own range
+ * - version 1 text keys then start the combine where verification left
+ *   them (as check does without it)
+ */
+bool verify(config* cfg, obj* src) {
+  cursor* cursors;
+  size_t indx;
+  bool success;
 
-      fseek(src->data, (-1 * src_read), SEEK_CUR);
-      fseek(src->data, indx, SEEK_CUR);
+  if (!cfg->quiet) {
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
+    printf("Verifying source %s with all keys (%dsec & %dms)\n", src->name, msec / 1000, msec % 1000);
+  }
+
+  if (cfg->threads > 1) {
+    success = run_workers(cfg, src, true);
+  } else if (!(cursors = open_cursors(cfg, false))) {
+    return false;
+  } else {
+    success = verify_range(cfg, src, cursors, src->buff, 0, src->size);
+    close_cursors(cfg, cursors);
+  }
+
+  for (indx = 0; success && cfg->keystream == 1 && indx < cfg->key_length; indx++) {
+    if (!cfg->keys[indx].key->is_file && src->size > 0) {
+      cfg->keys[indx].key->passes = ((src->size - 1) / cfg->keys[indx].key->size) + 1;
     }
-    return true;
   }
-  return false;
+  return success;
+}
+
+/**
+ * Run every key over a range of the source, the result is dropped
+ */
+bool verify_range(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end) {
+  size_t length;
+
+  while (start < end) {
+    length = end - start;
+    if (length > cfg->buffer_size) {
+      length = cfg->buffer_size;
+    }
+
+    if (!io_read_at(&src->io, buff, length, start)) {
+      printf("Unable to read from %s\n", src->name);
+      return false;
+    }
+    if (!apply_cursors(cfg, cursors, buff, length)) {
+      return false;
+    }
+    start += length;
+  }
+  return true;
 }
 
 //------------------------------------------------------------------------------
 // Encryption / Decryption
 
 /**
- * Combine the source file with an encryption key
+ * Combine the source file with every encryption key in a single pass
+ * - each source chunk is read once, every layer is applied while it is
+ *   still in cache, and the result is written once
  */
-bool combine(config* cfg, obj* src, obj* key, FILE* output_stream) {
-  int src_read;
-  int key_read;
-
-  int indx;
+bool combine(config* cfg, obj* src, vke_io* output) {
+  cursor* cursors;
+  size_t indx;
+  bool success;
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
 
     if (cfg->dry_run) {
       printf("\n\n");
     }
-    printf("Combining source %s with key %s (%dsec & %dms)\n", src->name, key->name, msec / 1000, msec % 1000);
+    for (indx = 0; indx < cfg->key_length; indx++) {
+      printf("Combining source %s with key %s (%dsec & %dms)\n", src->name, cfg->keys[indx].key->name, msec / 1000, msec % 1000);
+    }
 
     if (cfg->dry_run) {
       printf("\n\n");
     }
   }
 
-  fseek(src->data, 0, SEEK_SET);
   src->indx = 0;
 
-  if (key->is_file) {
-    fseek(key->data, 0, SEEK_SET);
-    key->indx = 0;
+  if (cfg->threads > 1 && output == src->out && output->positional) {
+    return combine_parallel(cfg, src);
+  }
+  if (!(cursors = open_cursors(cfg, false))) {
+    return false;
   }
 
+  // Out of place output always overlaps reads and writes in a pipeline
+  if (cfg->uring && output == &src->io) {
+    success = combine_uring(cfg, src, cursors);
+  } else if (output == src->out && (cfg->pipeline > 0 || output != &src->io)) {
+    success = combine_pipeline(cfg, src, cursors);
+  } else if (cfg->mmap && output == &src->io) {
+    success = combine_mapped(cfg, src, cursors, 0, src->size);
+  } else {
+    success = combine_stream(cfg, src, cursors, output);
+  }
+  close_cursors(cfg, cursors);
+  return success;
+}
+
+/**
+ * Combine through the source stream, writing each chunk to the output
+ */
+bool combine_stream(config* cfg, obj* src, cursor* cursors, vke_io* output) {
+  size_t src_read;
+
   while (src->indx < src->size) {
-    if ((src_read = fread(src->buff, 1, buff_size, src->data)) < 1) {
+    src_read = src->size - src->indx;
+    if (src_read > cfg->buffer_size) {
+      src_read = cfg->buffer_size;
+    }
+    probe2(read__start, src->indx, src_read);
+    if (!io_read_at(&src->io, src->buff, src_read, src->indx)) {
       printf("Unable to read from %s\n", src->name);
       return false;
     }
-    if (key->is_file) {
-      if ((key_read = fread(key->buff, 1, buff_size, key->data)) < buff_size) {
-        if (key_read < 1) {
-          printf("Unable to read from %s\n", key->name);
+    probe2(read__done, src->indx, src_read);
+
+    if (!apply_cursors(cfg, cursors, src->buff, src_read)) {
+      return false;
+    }
+
+    probe2(write__start, src->indx, src_read);
+    if (!io_write_at(output, src->buff, src_read, src->indx)) {
+      printf("Unable to write %s\n", src->name);
+      return false;
+    }
+    probe2(write__done, src->indx, src_read);
+    src->indx += src_read;
+  }
+  return true;
+}
+
+/**
+ * Combine stdin into the output chunk by chunk (source "-")
+ * - memory stays at one buffer whatever the stream length, pipes on either
+ *   side get pipe_size kernel buffers
+ * - version 1 text keys depend on the source size, which a stream does not
+ *   have, so they need keystream version 2
+ */
+bool combine_filter(config* cfg, vke_io* output) {
+  vke_io input;
+  cursor* cursors;
+  obj* key;
+  char* buff;
+  ssize_t src_read;
+  size_t offset = 0;
+  size_t indx;
+  bool success = true;
+
+  for (indx = 0; indx < cfg->key_length; indx++) {
+    key = cfg->keys[indx].key;
+
+    if (cfg->keystream == 1 && !key->is_file) {
+      printf("Unable to stream with text key %s (use --keystream 2)\n", key->name);
+      return false;
+    }
+    if (!cfg->quiet) {
+      int msec = (int)((stats_clock() - cfg->start) / 1000000);
+      printf("Combining source stdin with key %s (%dsec & %dms)\n", key->name, msec / 1000, msec % 1000);
+    }
+  }
+
+  io_attach(&input, STDIN_FILENO);
+  io_pipe_size(&input, pipe_size);
+  io_pipe_size(output, pipe_size);
+
+  if (!(cursors = open_cursors(cfg, false))) {
+    return false;
+  }
+  if (!(buff = pool_take(&cfg->buffers))) {
+    printf("Unable to buffer stdin\n");
+    close_cursors(cfg, cursors);
+    return false;
+  }
+
+  probe2(read__start, offset, cfg->buffer_size);
+  while (success && (src_read = io_read(&input, buff, cfg->buffer_size, 0)) > 0) {
+    probe2(read__done, offset, src_read);
+
+    if (!apply_cursors(cfg, cursors, buff, src_read)) {
+      success = false;
+    } else {
+      probe2(write__start, offset, src_read);
+      if (!io_write_at(output, buff, src_read, offset)) {
+        printf("Unable to write %s\n", ((cfg->output) ? cfg->output : "stdout"));
+        success = false;
+      }
+      probe2(write__done, offset, src_read);
+    }
+    offset += src_read;
+    probe2(read__start, offset, cfg->buffer_size);
+  }
+  if (success && src_read < 0) {
+    printf("Unable to read from stdin\n");
+    success = false;
+  }
+
+  pool_give(&cfg->buffers, buff);
+  close_cursors(cfg, cursors);
+  return success;
+}
+
+/**
+ * Combine a range of the source in place through memory mapped windows
+ * - no read/write copies or per chunk syscalls, the page cache is
+ *   XORed directly and written back by the kernel
+ * - ranges larger than map_size are processed one window at a time
+ * - ranges start on buffer size multiples, so a window is mapped from the
+ *   page before the range starts and the leading bytes are skipped
+ */
+bool combine_mapped(config* cfg, obj* src, cursor* cursors, size_t start,
+    size_t end) {
+  size_t length;
+  size_t offset;
+  size_t count;
+  size_t skip;
+  char* window;
+
+  while (start < end) {
+    skip   = start % page_align;
+    length = end - start;
+    if (length > map_size) {
+      length = map_size;
+    }
+
+    window = mmap(NULL, skip + length, PROT_READ | PROT_WRITE, MAP_SHARED,
+        src->io.fd, start - skip);
+    stats_call(call_map);
+
+    if (window == MAP_FAILED) {
+      printf("Unable to map %s\n", src->name);
+      return false;
+    }
+    madvise(window, skip + length, MADV_SEQUENTIAL);
+    madvise(window, skip + length, MADV_WILLNEED);
+    stats_call(call_map);
+    stats_call(call_map);
+
+    for (offset = 0; offset < length; offset += count) {
+      count = length - offset;
+      if (count > cfg->buffer_size) {
+        count = cfg->buffer_size;
+      }
+      if (!apply_cursors(cfg, cursors, window + skip + offset, count)) {
+        munmap(window, skip + length);
+        return false;
+      }
+    }
+
+    stats_call(call_map);
+
+    if (munmap(window, skip + length) != 0) {
+      printf("Unable to write %s\n", src->name);
+      return false;
+    }
+    start += length;
+  }
+  return true;
+}
+
+/**
+ * Combine the source in place through a reader / transform / writer pipeline
+ * - the reader and writer run on their own threads and hand preallocated
+ *   chunks around through lock-free rings, so I/O in both directions
+ *   overlaps with the XOR work done on the calling thread
+ * - cfg->pipeline (or queue_depth) chunks are in flight at most
+ */
+bool combine_pipeline(config* cfg, obj* src, cursor* cursors) {
+  pipeline line;
+  chunk* chunks;
+  size_t depth = ((cfg->pipeline > 0) ? cfg->pipeline : queue_depth);
+  size_t indx;
+  bool success = true;
+
+  line.cfg   = cfg;
+  line.src   = src;
+  line.count = ((src->size + cfg->buffer_size - 1) / cfg->buffer_size);
+  atomic_init(&line.failed, false);
+
+  if (line.count == 0) {
+    return true;
+  }
+  if (!(chunks = (chunk*) calloc(depth, sizeof(chunk)))) {
+    printf("Unable to buffer %s\n", src->name);
+    return false;
+  }
+
+  line.free.slots = NULL;
+  line.full.slots = NULL;
+  line.done.slots = NULL;
+
+  if (!ring_init(&line.free, depth) || !ring_init(&line.full, depth)
+      || !ring_init(&line.done, depth)) {
+    success = false;
+  }
+  for (indx = 0; success && indx < depth; indx++) {
+    if (!(chunks[indx].buff = pool_take(&cfg->buffers))) {
+      success = false;
+    } else {
+      ring_push(&line.free, &chunks[indx]);
+    }
+  }
+
+  if (!success) {
+    printf("Unable to buffer %s\n", src->name);
+  } else {
+    success = run_pipeline(&line, cursors);
+  }
+
+  for (indx = 0; indx < depth; indx++) {
+    if (chunks[indx].buff != NULL) {
+      pool_give(&cfg->buffers, chunks[indx].buff);
+    }
+  }
+  ring_free(&line.free);
+  ring_free(&line.full);
+  ring_free(&line.done);
+  free(chunks);
+  return success;
+}
+
+/**
+ * Start the reader and writer stages and run the transform stage
+ */
+bool run_pipeline(pipeline* line, cursor* cursors) {
+  chunk* current = NULL;
+  pthread_t reader;
+  pthread_t writer;
+  size_t indx;
+  unsigned int spins;
+
+  if (pthread_create(&reader, NULL, pipeline_reader, line) != 0) {
+    printf("Unable to start reader for %s\n", line->src->name);
+    return false;
+  }
+  if (pthread_create(&writer, NULL, pipeline_writer, line) != 0) {
+    printf("Unable to start writer for %s\n", line->src->name);
+    atomic_store(&line->failed, true);
+    pthread_join(reader, NULL);
+    return false;
+  }
+
+  for (indx = 0; indx < line->count; indx++) {
+    spins = 0;
+    while (!(current = ring_pop(&line->full))) {
+      if (atomic_load(&line->failed)) {
+        break;
+      }
+      ring_wait(&spins);
+    }
+    if (current == NULL) {
+      break;
+    }
+    if (!apply_cursors(line->cfg, cursors, current->buff, current->length)) {
+      atomic_store(&line->failed, true);
+      break;
+    }
+    ring_push(&line->done, current);
+  }
+
+  pthread_join(reader, NULL);
+  pthread_join(writer, NULL);
+  return !atomic_load(&line->failed);
+}
+
+/**
+ * Pipeline reader stage
+ */
+void* pipeline_reader(void* data) {
+  pipeline* line = (pipeline*) data;
+  chunk* current;
+  size_t indx;
+  unsigned int spins;
+
+  for (indx = 0; indx < line->count; indx++) {
+    spins = 0;
+    while (!(current = ring_pop(&line->free))) {
+      if (atomic_load(&line->failed)) {
+        return NULL;
+      }
+      ring_wait(&spins);
+    }
+
+    current->offset = indx * line->cfg->buffer_size;
+    current->length = line->src->size - current->offset;
+    if (current->length > line->cfg->buffer_size) {
+      current->length = line->cfg->buffer_size;
+    }
+
+    probe2(read__start, current->offset, current->length);
+    if (!io_read_at(&line->src->io, current->buff, current->length,
+        current->offset)) {
+      printf("Unable to read from %s\n", line->src->name);
+      atomic_store(&line->failed, true);
+      return NULL;
+    }
+    probe2(read__done, current->offset, current->length);
+    ring_push(&line->full, current);
+  }
+  return NULL;
+}
+
+/**
+ * Pipeline writer stage
+ */
+void* pipeline_writer(void* data) {
+  pipeline* line = (pipeline*) data;
+  chunk* current;
+  size_t indx;
+  unsigned int spins;
+
+  for (indx = 0; indx < line->count; indx++) {
+    spins = 0;
+    while (!(current = ring_pop(&line->done))) {
+      if (atomic_load(&line->failed)) {
+        return NULL;
+      }
+      ring_wait(&spins);
+    }
+
+    probe2(write__start, current->offset, current->length);
+    if (!io_write_at(line->src->out, current->buff, current->length,
+        current->offset)) {
+      printf("Unable to write %s\n", line->src->name);
+      atomic_store(&line->failed, true);
+      return NULL;
+    }
+    probe2(write__done, current->offset, current->length);
+    ring_push(&line->free, current);
+  }
+  return NULL;
+}
+
+/**
+ * Combine the source in place with batched io_uring reads and writes
+ * - chunk buffers are registered with the kernel (fixed buffers) and up to
+ *   cfg->pipeline (or queue_depth) chunks are in flight at once
+ * - chunks are XORed strictly in source order as their reads complete
+ * - falls back to the plain stream path when io_uring is unavailable
+ */
+bool combine_uring(config* cfg, obj* src, cursor* cursors) {
+  uring rng;
+  chunk* chunks;
+  struct iovec* buffers;
+  size_t depth = ((cfg->pipeline > 0) ? cfg->pipeline : queue_depth);
+  size_t indx;
+  size_t end;
+  bool success = true;
+
+  if (src->size == 0) {
+    return true;
+  }
+  if (!uring_init(&rng, depth * 2, cfg->sqpoll)) {
+    if (!cfg->quiet) {
+      printf("io_uring is unavailable, using plain I/O for %s\n", src->name);
+    }
+    return combine_stream(cfg, src, cursors, &src->io);
+  }
+
+  chunks  = (chunk*) calloc(depth, sizeof(chunk));
+  buffers = (struct iovec*) calloc(depth, sizeof(struct iovec));
+
+  for (indx = 0; success && chunks && buffers && indx < depth; indx++) {
+    if (!(chunks[indx].buff = pool_take(&cfg->buffers))) {
+      success = false;
+    }
+    buffers[indx].iov_base = chunks[indx].buff;
+    buffers[indx].iov_len  = cfg->buffer_size;
+  }
+
+  if (!chunks || !buffers || !success) {
+    printf("Unable to buffer %s\n", src->name);
+    success = false;
+  } else if (!uring_register_buffers(&rng, buffers, depth)
+      || !uring_register_file(&rng, src->io.fd)) {
+    if (!cfg->quiet) {
+      printf("io_uring is unavailable, using plain I/O for %s\n", src->name);
+    }
+    success = combine_stream(cfg, src, cursors, &src->io);
+  } else {
+    // The unaligned tail of a direct source is left to the cached path
+    end = src->size - ((src->io.direct) ? (src->size % src->io.align) : 0);
+
+    success = run_uring(cfg, src, cursors, &rng, chunks, depth, end);
+
+    if (success && end < src->size) {
+      success = combine_range(cfg, src, cursors, chunks[0].buff, end,
+          src->size);
+    }
+  }
+  uring_exit(&rng);
+
+  for (indx = 0; chunks && indx < depth; indx++) {
+    if (chunks[indx].buff != NULL) {
+      pool_give(&cfg->buffers, chunks[indx].buff);
+    }
+  }
+  free(buffers);
+  free(chunks);
+  return success;
+}
+
+/**
+ * io_uring combine loop over the source up to end
+ * - user data carries the chunk slot and whether the request was a write
+ * - short transfers are requeued for the remainder
+ */
+bool run_uring(config* cfg, obj* src, cursor* cursors, uring* rng,
+    chunk* chunks, size_t depth, size_t end) {
+  size_t size    = cfg->buffer_size;
+  size_t count   = ((end + size - 1) / size);
+  size_t reads   = 0;
+  size_t applied = 0;
+  size_t written = 0;
+  size_t slot;
+  unsigned long long data;
+  int result;
+  chunk* current;
+  bool queued = true;
+
+  for (slot = 0; slot < depth && reads < count; slot++, reads++) {
+    chunks[slot].offset = reads * size;
+    chunks[slot].length = end - chunks[slot].offset;
+    if (chunks[slot].length > size) {
+      chunks[slot].length = size;
+    }
+    chunks[slot].done  = 0;
+    chunks[slot].state = chunk_reading;
+
+    probe2(read__start, chunks[slot].offset, chunks[slot].length);
+    queued = queued && uring_read(rng, slot, chunks[slot].buff,
+        chunks[slot].length, chunks[slot].offset, (slot << 1));
+  }
+
+  while (queued && written < count) {
+    if (!uring_submit(rng, 1)) {
+      printf("Unable to submit I/O for %s\n", src->name);
+      return false;
+    }
+
+    while (queued && uring_complete(rng, &data, &result)) {
+      current = &chunks[data >> 1];
+
+      if (result < 1) {
+        printf(((data & 1) ? "Unable to write %s\n" : "Unable to read from %s\n"), src->name);
+        return false;
+      }
+      current->done += result;
+      stats_bytes(((data & 1) ? call_write : call_read), result);
+
+      if (current->done < current->length) {
+        if (data & 1) {
+          queued = uring_write(rng, (data >> 1), current->buff + current->done,
+              current->length - current->done, current->offset + current->done, data);
+        } else {
+          queued = uring_read(rng, (data >> 1), current->buff + current->done,
+              current->length - current->done, current->offset + current->done, data);
+        }
+      } else if (!(data & 1)) {
+        probe2(read__done, current->offset, current->length);
+        current->state = chunk_ready;
+      } else {
+        probe2(write__done, current->offset, current->length);
+        written++;
+        current->state = chunk_idle;
+
+        if (reads < count) {
+          current->offset = reads * size;
+          current->length = end - current->offset;
+          if (current->length > size) {
+            current->length = size;
+          }
+          current->done  = 0;
+          current->state = chunk_reading;
+          reads++;
+
+          probe2(read__start, current->offset, current->length);
+          queued = uring_read(rng, (data >> 1), current->buff, current->length,
+              current->offset, (data & ~1ULL));
+        }
+      }
+    }
+
+    // Apply the key layers in source order and queue the writes
+    slot = 0;
+    while (queued && slot < depth) {
+      current = &chunks[slot];
+
+      if (current->state == chunk_ready
+          && current->offset == applied * size) {
+        if (!apply_cursors(cfg, cursors, current->buff, current->length)) {
           return false;
         }
-        fseek(key->data, 0, SEEK_SET);
-        key->indx = 0;
+        current->done  = 0;
+        current->state = chunk_writing;
+        applied++;
+
+        probe2(write__start, current->offset, current->length);
+        queued = uring_write(rng, slot, current->buff, current->length,
+            current->offset, ((slot << 1) | 1));
+        slot = 0;
+      } else {
+        slot++;
       }
-    } else {
-      key_read = key->size;
     }
+  }
 
-    sanitize_buffer(key, key_read);
+  if (!queued) {
+    printf("Unable to queue I/O for %s\n", src->name);
+    return false;
+  }
+  return true;
+}
 
-    indx = 0;
-    while ((indx < src_read) && (indx < key_read)) {
-      src->buff[indx] = src->buff[indx] ^ key->buff[indx];
-      indx++;
-      src->indx++;
-      key->indx++;
+/**
+ * Combine a range of the source in place with positional reads and writes
+ */
+bool combine_range(config* cfg, obj* src, cursor* cursors, char* buff,
+    size_t start, size_t end) {
+  size_t length;
+
+  while (start < end) {
+    length = end - start;
+    if (length > cfg->buffer_size) {
+      length = cfg->buffer_size;
     }
 
-    fseek(src->data, (-1 * src_read), SEEK_CUR);
+    probe2(read__start, start, length);
+    if (!io_read_at(&src->io, buff, length, start)) {
+      printf("Unable to read from %s\n", src->name);
+      return false;
+    }
+    probe2(read__done, start, length);
 
-    if (fwrite(src->buff, 1, indx, output_stream) < indx) {
+    if (!apply_cursors(cfg, cursors, buff, length)) {
+      return false;
+    }
+
+    probe2(write__start, start, length);
+    if (!io_write_at(src->out, buff, length, start)) {
       printf("Unable to write %s\n", src->name);
       return false;
     }
-    fflush(output_stream);
+    probe2(write__done, start, length);
+    start += length;
+  }
+  return true;
+}
+
+/**
+ * Combine (or verify) worker thread
+ * - positions a private set of key cursors at the start of its range
+ */
+void* combine_worker(void* data) {
+  worker* work = (worker*) data;
+  cursor* cursors;
+  char* buff;
+  size_t indx;
+
+  work->success = false;
+
+  if (!(cursors = open_cursors(work->cfg, true))) {
+    return NULL;
+  }
+  if (!(buff = pool_take(&work->cfg->buffers))) {
+    printf("Unable to buffer %s\n", work->src->name);
+    close_cursors(work->cfg, cursors);
+    return NULL;
+  }
+
+  work->success = true;
+  for (indx = 0; indx < work->cfg->key_length; indx++) {
+    if (!seek_cursor(&cursors[indx], work->start)) {
+      work->success = false;
+      break;
+    }
+  }
+
+  if (work->success) {
+    if (work->verify) {
+      work->success = verify_range(work->cfg, work->src, cursors, buff,
+          work->start, work->end);
+    } else if (work->cfg->mmap) {
+      work->success = combine_mapped(work->cfg, work->src, cursors,
+          work->start, work->end);
+    } else {
+      work->success = combine_range(work->cfg, work->src, cursors, buff,
+          work->start, work->end);
+    }
+  }
+
+  pool_give(&work->cfg->buffers, buff);
+  close_cursors(work->cfg, cursors);
+  return NULL;
+}
+
+/**
+ * Combine the source in place with one worker per contiguous range
+ * - ranges are aligned to the buffer size and every worker computes its own key
+ *   stream position, so the output matches the sequential combine
+ */
+bool combine_parallel(config* cfg, obj* src) {
+  return run_workers(cfg, src, false);
+}
+
+/**
+ * Start one worker per contiguous source range and wait for all of them
+ * (verify runs the keys only, nothing is written)
+ */
+bool run_workers(config* cfg, obj* src, bool verify) {
+  size_t chunks = ((src->size + cfg->buffer_size - 1) / cfg->buffer_size);
+  size_t per_worker;
+  size_t count;
+  size_t indx;
+  worker* workers;
+  bool success = true;
+
+  count = cfg->threads;
+  if (count > chunks) {
+    count = chunks;
+  }
+  if (count < 1) {
+    return true;
+  }
+  per_worker = ((chunks + count - 1) / count) * cfg->buffer_size;
+
+  if (!(workers = (worker*) calloc(count, sizeof(worker)))) {
+    printf("Unable to create workers for %s\n", src->name);
+    return false;
+  }
+
+  for (indx = 0; indx < count; indx++) {
+    workers[indx].cfg    = cfg;
+    workers[indx].src    = src;
+    workers[indx].verify = verify;
+    workers[indx].start  = indx * per_worker;
+    workers[indx].end    = workers[indx].start + per_worker;
+
+    if (workers[indx].end > src->size) {
+      workers[indx].end = src->size;
+    }
+    if (pthread_create(&workers[indx].thread, NULL, combine_worker,
+        &workers[indx]) != 0) {
+      printf("Unable to start worker %lu for %s\n", indx, src->name);
+      workers[indx].started = false;
+      success = false;
+    } else {
+      workers[indx].started = true;
+    }
+  }
+
+  for (indx = 0; indx < count; indx++) {
+    if (workers[indx].started) {
+      pthread_join(workers[indx].thread, NULL);
+
+      if (!workers[indx].success) {
+        success = false;
+      }
+    }
+  }
+  free(workers);
+  return success;
+}
+
+//------------------------------------------------------------------------------
+// Key streams
+//
+// Keystream version 1 (the original format) sanitizes each key in chunks of
+// key_block bytes: file keys chunk by chunk with a short read wrapping back
+// to the start, text keys by sanitizing their filled buffer once more for
+// every chunk.
+//
+// Keystream version 2 depends on nothing but the position p in the stream:
+//
+//   byte(p) = sanitize(material[p % size], p % key_block, key_block)
+//
+// where the material is the key file or the (hashed) key text as is.  Any
+// offset can be computed directly and the result does not depend on the
+// source size or on how the source is read.
+//
+// Version 1 file keys and every version 2 key are a function of the stream
+// position alone, so their cursors keep nothing but that position and
+// compute the bytes they XOR into a scratch buffer all cursors of a set
+// share.  Only a version 1 text key carries state (its chunk, sanitized
+// once more for every pass) in a key_block buffer of its own.
+
+/**
+ * Number of key_block buffers a cursor set needs (the scratch buffer and
+ * one chunk for every version 1 text key)
+ */
+size_t cursor_buffers(config* cfg) {
+  size_t count = 1;
+  size_t indx;
+
+  for (indx = 0; cfg->keystream == 1 && indx < cfg->key_length; indx++) {
+    if (!cfg->keys[indx].key->is_file) {
+      count++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Create a cursor for every key layer
+ * - the scratch buffer and the version 1 text chunks are one allocation,
+ *   key objects keep nothing but their material
+ * - version 1 text cursors of a single sequential pass start from the
+ *   filled material advanced by the passes check (or verify) marked,
+ *   private cursors are positioned by seek_cursor or place_cursor
+ */
+cursor* open_cursors(config* cfg, bool private) {
+  cursor* cursors;
+  char* buffers;
+  layer* temp;
+  size_t chunks = 0;
+  size_t indx;
+
+  if (!(cursors = (cursor*) calloc(cfg->key_length, sizeof(cursor)))) {
+    printf("Unable to create key cursors\n");
+    return NULL;
+  }
+  if (!(buffers = alloc_buffer(cursor_buffers(cfg) * key_block))) {
+    printf("Unable to buffer key cursors\n");
+    free(cursors);
+    return NULL;
+  }
+
+  for (indx = 0; indx < cfg->key_length; indx++) {
+    temp = &cfg->keys[indx];
+
+    cursors[indx].key     = temp->key;
+    cursors[indx].layr    = temp;
+    cursors[indx].version = cfg->keystream;
+    cursors[indx].scratch = buffers;
+    cursors[indx].buff    = buffers;
+    cursors[indx].read    = 0;
+    cursors[indx].indx    = 0;
+    cursors[indx].offset  = 0;
+
+    if (cfg->keystream == 1 && !temp->key->is_file) {
+      cursors[indx].buff = buffers + (++chunks * key_block);
+
+      if (!private) {
+        fill_key_buffer(temp->key, cursors[indx].buff);
+        advance_key_buffer(cursors[indx].buff, temp->key->size, temp->key->passes);
+      }
+    }
+  }
+
+  return cursors;
+}
+
+/**
+ * Release key cursors
+ */
+void close_cursors(config* cfg, cursor* cursors) {
+  free_buffer(cursors[0].scratch, cursor_buffers(cfg) * key_block);
+  free(cursors);
+}
+
+/**
+ * Position a private cursor at a byte offset of the key stream
+ * - version 1 file keys are periodic in their size
+ * - version 1 text keys are sanitized once more for every chunk, so the
+ *   buffer is filled from the key material and advanced by the number of
+ *   chunks
+ */
+bool seek_cursor(cursor* cur, size_t position) {
+  obj* key = cur->key;
+
+  cur->read   = 0;
+  cur->indx   = 0;
+  cur->offset = position;
+
+  if (cur->version == 1 && key->is_file) {
+    cur->offset = position % key->size;
+  } else if (cur->version == 1) {
+    fill_key_buffer(key, cur->buff);
+    advance_key_buffer(cur->buff, key->size, key->passes + (position / key->size) + 1);
+
+    cur->read = key->size;
+    cur->indx = position % key->size;
+  }
+  return true;
+}
+
+/**
+ * Position a private cursor at a byte offset of the key stream for a source
+ * of src_size bytes (batch and recursive modes)
+ * - key objects are checked against an empty source, so version 1 text
+ *   keys are still unadvanced and get the passes check() would have made
+ *   for this source here
+ */
+bool place_cursor(cursor* cur, size_t src_size, size_t position) {
+  obj* key = cur->key;
+
+  if (cur->version != 1) {
+    return seek_cursor(cur, position);
+  }
+  if (key->is_file) {
+    if ((key->size % key_block) == 0 && src_size > key->size) {
+      printf("Unable to read from %s\n", key->name);
+      return false;
+    }
+    return seek_cursor(cur, position);
   }
+
+  fill_key_buffer(key, cur->buff);
+  advance_key_buffer(cur->buff, key->size, (position / key->size) + 1
+      + ((src_size > 0) ? ((src_size - 1) / key->size) + 1 : 0));
+
+  cur->read = key->size;
+  cur->indx = position % key->size;
+  return true;
+}
+
+/**
+ * Load the next bytes of a key stream (at most length, and no further than
+ * the end of their key chunk)
+ * - a version 1 text key sanitizes its whole chunk once more
+ * - any other key reads just those bytes into the scratch buffer and
+ *   sanitizes them with their place in the chunk, version 1 file keys
+ *   wrap around to the beginning after their short last chunk
+ */
+bool load_cursor(cursor* cur, size_t length) {
+  obj* key = cur->key;
+  size_t start;
+  size_t key_read;
+  size_t count;
+  perf_sample sample;
+
+  if (cur->version == 1 && !key->is_file) {
+    probe2(sanitize, cur->layr->indx, key->size);
+    perf_begin(&sample);
+    sanitize_bytes(cur->buff, 0, key->size, key->size);
+    perf_stage(perf_sanitize, &sample, key->size);
+
+    cur->read = key->size;
+    cur->indx = 0;
+    return true;
+  }
+
+  if (cur->version == 1 && cur->offset == key->size) {
+    // A key that is an exact multiple of the key block never wraps around
+    if ((key->size % key_block) == 0) {
+      printf("Unable to read from %s\n", key->name);
+      return false;
+    }
+    probe2(key__wrap, cur->layr->indx, key->size % key_block);
+    cur->offset = 0;
+  }
+
+  start    = cur->offset - (cur->offset % key_block);
+  key_read = key_block;
+  if (cur->version == 1 && key->size - start < key_block) {
+    key_read = key->size - start;
+  }
+  count = start + key_read - cur->offset;
+  if (count > length) {
+    count = length;
+  }
+
+  if (cur->version != 1) {
+    if (!load_material(cur, count)) {
+      return false;
+    }
+  } else if (!io_read_at(&key->io, cur->buff, count, cur->offset)) {
+    printf("Unable to read from %s\n", key->name);
+    return false;
+  }
+
+  probe2(sanitize, cur->layr->indx, count);
+  perf_begin(&sample);
+  sanitize_bytes(cur->buff, cur->offset - start, count, key_read);
+  perf_stage(perf_sanitize, &sample, count);
+
+  cur->offset += count;
+  cur->read    = count;
+  cur->indx    = 0;
+  return true;
+}
+
+/**
+ * Fill a cursor buffer with the key material for stream bytes
+ * offset .. offset + length (version 2)
+ * - the material repeats, so once a whole copy is in the buffer the rest
+ *   is filled by doubling it in memory
+ */
+bool load_material(cursor* cur, size_t length) {
+  obj* key = cur->key;
+  size_t start = cur->offset % key->size;
+  size_t done  = 0;
+  size_t period;
+  size_t count;
+
+  while (done < length) {
+    if (done >= key->size) {
+      // Copied from whole periods back, even when the last copy is cut short
+      period = (done / key->size) * key->size;
+      count  = period;
+      if (count > (length - done)) {
+        count = length - done;
+      }
+      memcpy(cur->buff + done, cur->buff + done - period, count);
+    } else {
+      count = key->size - ((start + done) % key->size);
+      if (count > (length - done)) {
+        count = length - done;
+      }
+
+      if (!key->is_file) {
+        memcpy(cur->buff + done, key->buff + ((start + done) % key->size), count);
+      } else if (!io_read_at(&key->io, cur->buff + done, count,
+          (start + done) % key->size)) {
+        printf("Unable to read from %s\n", key->name);
+        return false;
+      }
+    }
+    done += count;
+  }
+  return true;
+}
+
+/**
+ * XOR the next length bytes of a key stream into a buffer
+ * - a key chunk may span several source chunks and vice versa
+ */
+bool apply_cursor(cursor* cur, char* buff, size_t length) {
+  size_t done = 0;
+  size_t count;
+  perf_sample sample;
+
+  while (done < length) {
+    if (cur->indx >= cur->read && !load_cursor(cur, length - done)) {
+      return false;
+    }
+    count = cur->read - cur->indx;
+    if (count > (length - done)) {
+      count = length - done;
+    }
+
+    probe2(xor, cur->layr->indx, count);
+    perf_begin(&sample);
+    xor_buffer(buff + done, cur->buff + cur->indx, count);
+    perf_stage(perf_xor, &sample, count);
+
+    done      += count;
+    cur->indx += count;
+  }
+  return true;
+}
+
+/**
+ * XOR every key layer into a buffer
+ * - with --stats each layer is timed on its own (compute time includes
+ *   loading the next key chunks)
+ * - the byte counters feed --stats and --progress
+ */
+bool apply_cursors(config* cfg, cursor* cursors, char* buff, size_t length) {
+  uint64_t begin;
+  size_t indx;
+
+  for (indx = 0; indx < cfg->key_length; indx++) {
+    begin = stats_begin();
+    probe2(layer__start, indx, length);
+
+    if (!apply_cursor(&cursors[indx], buff, length)) {
+      return false;
+    }
+    probe2(layer__done, indx, length);
+    if (begin) {
+      stats_layer(cursors[indx].layr, phase_compute, stats_since(begin));
+    }
+    stats_combined(cursors[indx].layr, length);
+  }
+  stats_combined(NULL, length);
   return true;
 }
 
 //------------------------------------------------------------------------------
-// Buffer operations
+// Output targets
+
+/**
+ * Open the --output target, the source is then only read
+ * - block devices are written directly, character devices and FIFOs
+ *   directly and in order (they are neither sized nor truncated)
+ * - a regular or missing target is written to a temporary file next to
+ *   it that replaces it once complete, a symbolic link is resolved first
+ *   so the file it points to is replaced and not the link
+ * - the new file keeps the mode of the target it replaces (or the source,
+ *   or gets the default mode for a stream)
+ */
+bool open_output(config* cfg, obj* src, vke_io* target) {
+  struct stat info;
+  const char* path = cfg->output;
+  bool found = (stat(cfg->output, &info) == 0);
+  mode_t mode;
+  size_t size;
+
+  if (found && S_ISBLK(info.st_mode)) {
+    if (!io_open(target, cfg->output, true) || !io_size(target, &size)) {
+      printf("Unable to open %s\n", cfg->output);
+      io_close(target);
+      return false;
+    }
+    if (size < src->size) {
+      printf("Unable to write %s (smaller than %s)\n", cfg->output, src->name);
+      io_close(target);
+      return false;
+    }
+  } else if (found && (S_ISCHR(info.st_mode) || S_ISFIFO(info.st_mode))) {
+    if (!io_open(target, cfg->output, true)) {
+      printf("Unable to open %s\n", cfg->output);
+      return false;
+    }
+  } else if (found && !S_ISREG(info.st_mode)) {
+    printf("Unable to write %s (not a file or device)\n", cfg->output);
+    return false;
+  } else {
+    if (lstat(cfg->output, &info) == 0 && S_ISLNK(info.st_mode)) {
+      if (!(cfg->output_path = realpath(cfg->output, NULL))) {
+        printf("Unable to open %s\n", cfg->output);
+        return false;
+      }
+      path = cfg->output_path;
+    }
+    if (!(cfg->output_temp = (char*) malloc(strlen(path) + 8))) {
+      printf("Unable to open %s\n", cfg->output);
+      return false;
+    }
+    sprintf(cfg->output_temp, "%s.XXXXXX", path);
+
+    if (!io_temp(target, cfg->output_temp)) {
+      printf("Unable to create %s\n", cfg->output);
+      free(cfg->output_temp);
+      cfg->output_temp = NULL;
+      return false;
+    }
+    if (stat(path, &info) == 0
+        || (src->io.fd >= 0 && fstat(src->io.fd, &info) == 0)) {
+      mode = info.st_mode & 07777;
+    } else {
+      mode = umask(0);
+      umask(mode);
+      mode = 0666 & ~mode;
+    }
+    fchmod(target->fd, mode);
+    if (!io_truncate(target, src->size)) {
+      printf("Unable to write %s\n", cfg->output_temp);
+      close_output(cfg, target, false);
+      return false;
+    }
+  }
+  if (cfg->direct) {
+    io_direct(target);
+  }
+  src->out = target;
+  return true;
+}
 
 /**
- * Obfuscate the key buffer bytes
- * - so no source (hash or file) information shows through
- * - keep it simple
+ * Finish the --output target
+ * - on success the data is flushed (unless the target is a character
+ *   device or FIFO) and the temporary file is renamed over the target,
+ *   otherwise it is removed
  */
-void sanitize_buffer(obj* key, int key_read) {
-  int index  = 0;
+bool close_output(config* cfg, vke_io* target, bool success) {
+  const char* path = ((cfg->output_path != NULL) ? cfg->output_path : cfg->output);
 
-  while(index < key_read) {
-	  key->buff[index] = ((key->buff[index] + index) * key_read) % 255;
+  if (success && target->positional && !io_sync(target)) {
+    printf("Unable to write %s\n", cfg->output);
+    success = false;
+  }
+  io_close(target);
 
-	  if (key->buff[index] == 0) {
-	    key->buff[index] = 1;
-	  }
-	  index++;
+  if (cfg->output_temp != NULL) {
+    if (success && (rename(cfg->output_temp, path) != 0
+        || !io_sync_parent(path))) {
+      printf("Unable to write %s\n", cfg->output);
+      success = false;
+    }
+    if (!success) {
+      unlink(cfg->output_temp);
+    }
+    free(cfg->output_temp);
+    cfg->output_temp = NULL;
   }
+  free(cfg->output_path);
+  cfg->output_path = NULL;
+  return success;
 }
 
 //------------------------------------------------------------------------------
@@ -267,17 +1563,17 @@ void sanitize_buffer(obj* key, int key_read) {
  */
 bool finalize(config* cfg, obj* src) {
   int errors = 0;
+  size_t indx;
 
-  if (!finalize_source(cfg, src)) {
+  if (src->initialized && !finalize_source(cfg, src)) {
     errors++;
   }
 
-  layer* temp = cfg->keys;
-  do {
-    if (temp->key != NULL && !finalize_key(cfg, temp->key)) {
+  for (indx = 0; indx < cfg->key_length; indx++) {
+    if (cfg->keys[indx].key != NULL && !finalize_key(cfg, cfg->keys[indx].key)) {
       errors++;
     }
-  } while ((temp = temp->next) != NULL);
+  }
 
   return ((errors == 0) ? true : false);
 }
@@ -288,17 +1584,18 @@ bool finalize(config* cfg, obj* src) {
 bool finalize_source(config* cfg, obj* src) {
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
     printf("Finalizing session for source %s (%dsec & %dms)\n", src->name, msec / 1000, msec % 1000);
   }
 
   if (src->initialized) {
     if (src->buff != NULL) {
-      free(src->buff);
+      pool_give(&cfg->buffers, src->buff);
+      src->buff = NULL;
     }
 
-    if (src->is_file && src->data != NULL) {
-      fclose(src->data);
+    if (src->is_file) {
+      io_close(&src->io);
     }
   }
   return true;
@@ -310,28 +1607,13 @@ bool finalize_source(config* cfg, obj* src) {
 bool finalize_key(config* cfg, obj* key) {
 
   if (!cfg->quiet) {
-    int msec = ((clock_t)(clock() - cfg->start) * 1000 / CLOCKS_PER_SEC);
+    int msec = (int)((stats_clock() - cfg->start) / 1000000);
     printf("Finalizing session for key %s (%dsec & %dms)\n", key->name, msec / 1000, msec % 1000);
   }
 
-  if (key->buff != NULL) {
-    free(key->buff);
-  }
-  if (key->hash != NULL) {
-    free(key->hash);
-  }
-  if (key->rev_str != NULL) {
-    free(key->rev_str);
-  }
-  if (key->rev_hash != NULL) {
-    free(key->rev_hash);
-  }
-  if (key->final_hash != NULL) {
-    free(key->final_hash);
-  }
+  // The key object and its material belong to the arena
   if (key->is_file) {
-    fclose(key->data);
+    io_close(&key->io);
   }
-  free(key);
   return true;
 }
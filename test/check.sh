@@ -0,0 +1,319 @@
+#!/bin/bash
+#-------------------------------------------------------------------------------
+# VKE output equivalence checks (make check)
+#
+# Every combine mode has to produce the same bytes as the plain single
+# threaded path, whatever the buffer size.  Output, batch, recursive and
+# stream mode and key manifests are compared with it as well.
+#
+#   test/check.sh <vke binary>
+#-------------------------------------------------------------------------------
+
+VKE=$(realpath "${1:-build/vke}")
+WORK=$(mktemp -d)
+FAILED=0
+CHECKS=0
+
+trap 'rm -rf "$WORK"' EXIT
+cd "$WORK" || exit 2
+
+SIZES="0 1 4097 102399 102400 102401 1000000 3000000"
+LONG_TEXT=$(printf 'long text key %.0s' $(seq 1 20))
+KEY_SETS=(
+  "k150k"
+  "k5k|key string"
+  "key string|$LONG_TEXT|k150k|k250k"
+)
+
+#-------------------------------------------------------------------------------
+# Helpers
+
+fail() {
+  echo "FAIL: $*"
+  FAILED=$((FAILED + 1))
+}
+
+# Combine a copy of every source with each option set and compare it with
+# the plain path (same keystream), the reference has to decrypt back
+#   check_modes <keystream> <option set> ...
+check_modes() {
+  local keystream=$1
+  local keys
+  local size
+  local mode
+  shift
+
+  for keys in "${KEY_SETS[@]}"; do
+    IFS='|' read -ra KEYS <<< "$keys"
+
+    for size in $SIZES; do
+      cp "src_$size" ref
+      "$VKE" -q -k "$keystream" ref "${KEYS[@]}" > /dev/null 2>&1 \
+          || fail "v$keystream plain size=$size keys=${keys:0:30}"
+      cp ref round
+      "$VKE" -q -k "$keystream" round "${KEYS[@]}" > /dev/null 2>&1
+      cmp -s round "src_$size" \
+          || fail "v$keystream round trip size=$size keys=${keys:0:30}"
+
+      for mode in "$@"; do
+        CHECKS=$((CHECKS + 1))
+        cp "src_$size" out
+        # shellcheck disable=SC2086
+        "$VKE" -q -k "$keystream" $mode out "${KEYS[@]}" > /dev/null 2>&1 \
+            || fail "v$keystream '$mode' exit size=$size keys=${keys:0:30}"
+        cmp -s ref out \
+            || fail "v$keystream '$mode' differs size=$size keys=${keys:0:30}"
+      done
+    done
+  done
+}
+
+#-------------------------------------------------------------------------------
+# Sources and keys
+
+for size in $SIZES; do
+  head -c "$size" /dev/urandom > "src_$size"
+done
+head -c 5000 /dev/urandom > k5k
+head -c 150000 /dev/urandom > k150k
+head -c 250000 /dev/urandom > k250k
+
+#-------------------------------------------------------------------------------
+# In place modes (buffer sizes that are not page or key block multiples)
+
+MODES=(
+  "-b 4096" "-b 12345" "-b 1M"
+  "-m" "-m -b 12345"
+  "-t 3" "-t 3 -b 12345" "-m -t 3 -b 12345"
+  "-p 4" "-p 3 -b 12345"
+  "-u" "-u -b 12345"
+  "--direct" "--direct -t 3" "--direct -p 3 -b 12345"
+  "-c" "-c -t 3 -b 12345"
+)
+check_modes 1 "${MODES[@]}"
+check_modes 2 "${MODES[@]}"
+
+#-------------------------------------------------------------------------------
+# Keystream 2 uses material[p % size] at stream position p, so a key and
+# a file of that key repeated many times make the same stream
+
+head -c 300 /dev/urandom > k300
+for i in $(seq 1 1000); do
+  cat k300
+done > k300x1000
+
+for size in $SIZES; do
+  for mode in "" "-b 12345" "-t 3 -b 12345"; do
+    CHECKS=$((CHECKS + 1))
+    cp "src_$size" ref
+    cp "src_$size" out
+    # shellcheck disable=SC2086
+    "$VKE" -q -k 2 $mode ref k300 > /dev/null 2>&1
+    # shellcheck disable=SC2086
+    "$VKE" -q -k 2 $mode out k300x1000 > /dev/null 2>&1
+    cmp -s ref out || fail "v2 '$mode' periodic key differs size=$size"
+  done
+done
+
+#-------------------------------------------------------------------------------
+# Output mode (the source is only read)
+
+for size in $SIZES; do
+  cp "src_$size" ref
+  "$VKE" -q ref k150k "key string" > /dev/null 2>&1
+
+  for mode in "" "-b 12345" "-p 3" "-u" "--direct"; do
+    CHECKS=$((CHECKS + 1))
+    cp "src_$size" in
+    rm -f out
+    # shellcheck disable=SC2086
+    "$VKE" -q $mode -o out in k150k "key string" > /dev/null 2>&1 \
+        || fail "output '$mode' exit size=$size"
+    cmp -s ref out || fail "output '$mode' differs size=$size"
+    cmp -s in "src_$size" || fail "output '$mode' changed the source size=$size"
+  done
+done
+
+# Targets that are not regular files are written through, never replaced
+cp src_3000000 ref
+"$VKE" -q ref k150k "key string" > /dev/null 2>&1
+mkfifo fifo
+
+for mode in "" "-t 3" "-p 3"; do
+  CHECKS=$((CHECKS + 1))
+  timeout 20 cat fifo > out &
+  # shellcheck disable=SC2086
+  "$VKE" -q $mode -o fifo src_3000000 k150k "key string" > /dev/null 2>&1 \
+      || fail "output '$mode' fifo exit"
+  wait
+  [ -p fifo ] || fail "output '$mode' replaced the fifo"
+  cmp -s ref out || fail "output '$mode' fifo differs"
+done
+
+CHECKS=$((CHECKS + 1))
+echo "old" > linked
+ln -s linked link
+"$VKE" -q -o link src_3000000 k150k "key string" > /dev/null 2>&1 \
+    || fail "output symlink exit"
+[ -L link ] || fail "output replaced the symlink"
+cmp -s ref linked || fail "output symlink target differs"
+
+if mknod null c 1 3 2> /dev/null; then
+  CHECKS=$((CHECKS + 1))
+  "$VKE" -q -o null src_3000000 k150k "key string" > /dev/null 2>&1 \
+      || fail "output character device exit"
+  [ -c null ] || fail "output replaced the character device"
+fi
+
+#-------------------------------------------------------------------------------
+# Batch mode (a newline list file and a NUL list on stdin)
+
+mkdir -p batch
+for keystream in 1 2; do
+  for size in $SIZES; do
+    cp "src_$size" "ref_$size"
+    "$VKE" -q -k "$keystream" "ref_$size" k150k "key string" > /dev/null 2>&1
+  done
+
+  for mode in "" "-t 3" "-t 3 -b 12345"; do
+    for list in "@list" "-"; do
+      CHECKS=$((CHECKS + 1))
+      : > list
+      for size in $SIZES; do
+        cp "src_$size" "batch/$size"
+        echo "batch/$size" >> list
+      done
+      # shellcheck disable=SC2086
+      tr '\n' '\0' < list | "$VKE" -q -k "$keystream" $mode -B "$list" \
+          k150k "key string" > /dev/null 2>&1 \
+          || fail "v$keystream batch '$mode' $list exit"
+      for size in $SIZES; do
+        cmp -s "ref_$size" "batch/$size" \
+            || fail "v$keystream batch '$mode' $list differs size=$size"
+      done
+    done
+  done
+done
+
+# A source listed twice (or under another link) is combined once
+cp src_3000000 ref
+"$VKE" -q ref k150k > /dev/null 2>&1
+for mode in "" "-t 3"; do
+  CHECKS=$((CHECKS + 1))
+  rm -f batch/twice batch/other
+  cp src_3000000 batch/twice
+  ln batch/twice batch/other
+  echo batch/other > list
+  # shellcheck disable=SC2086
+  "$VKE" -q $mode -B batch/twice -B @list k150k > /dev/null 2>&1 \
+      || fail "batch '$mode' repeated source exit"
+  cmp -s ref batch/twice || fail "batch '$mode' repeated source combined twice"
+done
+
+#-------------------------------------------------------------------------------
+# Recursive mode (a source larger than one range task)
+
+mkdir -p refs
+head -c 68000000 /dev/urandom > large
+TREE_FILES="sub/large medium sub/small"
+
+cp large refs/large
+cp src_3000000 refs/medium
+cp src_4097 refs/small
+for file in $TREE_FILES; do
+  "$VKE" -q "refs/${file##*/}" k150k "key string" > /dev/null 2>&1
+done
+
+for mode in "" "-t 4" "-m -t 4 -b 12345" "--direct -t 2"; do
+  CHECKS=$((CHECKS + 1))
+  rm -rf tree
+  mkdir -p tree/sub
+  cp large tree/sub/large
+  cp src_3000000 tree/medium
+  cp src_4097 tree/sub/small
+
+  # shellcheck disable=SC2086
+  "$VKE" -q -r tree k150k "key string" $mode > /dev/null 2>&1 \
+      || fail "recursive '$mode' exit"
+  for file in $TREE_FILES; do
+    cmp -s "tree/$file" "refs/${file##*/}" \
+        || fail "recursive '$mode' $file differs"
+  done
+done
+rm -rf tree large
+
+# A file with two links in the tree (or given twice) is combined once
+for mode in "" "-t 3" "-t 3 -r links/b"; do
+  CHECKS=$((CHECKS + 1))
+  rm -rf links
+  mkdir -p links/a links/b
+  cp src_3000000 links/a/file
+  ln links/a/file links/b/link
+  cp src_3000000 ref
+  "$VKE" -q ref k150k > /dev/null 2>&1
+
+  # shellcheck disable=SC2086
+  "$VKE" -q -r links k150k $mode > /dev/null 2>&1 \
+      || fail "recursive '$mode' hard link exit"
+  cmp -s ref links/a/file || fail "recursive '$mode' hard link combined twice"
+done
+rm -rf links
+
+#-------------------------------------------------------------------------------
+# Key manifests (the same keys as on the command line, before or after the
+# source)
+
+printf 'k150k\nkey string\n%s\nk5k\n' "$LONG_TEXT" > manifest
+
+for keystream in 1 2; do
+  for size in $SIZES; do
+    cp "src_$size" ref
+    "$VKE" -q -k "$keystream" ref k150k "key string" "$LONG_TEXT" k5k \
+        > /dev/null 2>&1
+
+    CHECKS=$((CHECKS + 1))
+    cp "src_$size" out
+    "$VKE" -q -k "$keystream" out --keys_from manifest > /dev/null 2>&1 \
+        || fail "v$keystream keys_from after exit size=$size"
+    cmp -s ref out || fail "v$keystream keys_from after differs size=$size"
+
+    CHECKS=$((CHECKS + 1))
+    cp "src_$size" out
+    "$VKE" -q -k "$keystream" --keys_from manifest out > /dev/null 2>&1 \
+        || fail "v$keystream keys_from before exit size=$size"
+    cmp -s ref out || fail "v$keystream keys_from before differs size=$size"
+  done
+done
+
+#-------------------------------------------------------------------------------
+# Stream mode (without -q, status lines must stay off stdout)
+
+for i in $(seq 1 150); do
+  echo "stream key $i"
+done > many_keys
+
+for size in $SIZES; do
+  for keys in "k150k|k5k" "--keys_from|many_keys|k150k"; do
+    IFS='|' read -ra KEYS <<< "$keys"
+
+    for keystream in 1 2; do
+      [ "$keystream" = 1 ] && [ "${KEYS[0]}" = "--keys_from" ] && continue
+
+      CHECKS=$((CHECKS + 1))
+      cp "src_$size" ref
+      "$VKE" -q -k "$keystream" ref "${KEYS[@]}" > /dev/null 2>&1
+      "$VKE" -k "$keystream" - "${KEYS[@]}" < "src_$size" > out 2> /dev/null \
+          || fail "v$keystream stream exit size=$size keys=${keys:0:30}"
+      cmp -s ref out \
+          || fail "v$keystream stream differs size=$size keys=${keys:0:30}"
+    done
+  done
+done
+
+#-------------------------------------------------------------------------------
+
+if [ $FAILED -gt 0 ]; then
+  echo "$FAILED of $CHECKS checks failed"
+  exit 1
+fi
+echo "All $CHECKS checks passed"